@@ -26,4 +26,43 @@ macro(add_filter FILTERNAME ENTRYFILES LINKFILES ENTRY_FN DEFINITIONS INCLUDES L
         target_include_directories(${FILTERNAME}_${VERSION} PRIVATE ${INCLUDES})
         file(READ ${CMAKE_CURRENT_SOURCE_DIR}/${FILTERNAME}.json FILTER_JSON_DESC)
         list(APPEND FILTERS_JSON_DESC "\"${FILTERNAME}_${VERSION}.wasm\":${FILTER_JSON_DESC}")
-endmacro()
\ No newline at end of file
+endmacro()
+# Decodes BMP assets at build time into const pixel arrays, written to ${NAME}_assets.c and
+# ${NAME}_assets.h in the binary directory and compiled into TARGET. FORMAT is rgbx, grey or
+# rgb565; extra qdbmp-bake options (-D to dither rgb565, -b for a single blob) follow the
+# BAKE_OPTIONS keyword. The baker runs on the build host: it is the qdbmp-bake target when
+# defined, QDBMP_BAKE when set (e.g. build-tools/qdbmp-bake from cmake -S tools -B build-tools)
+# or qdbmp-bake from the PATH.
+function(add_baked_assets TARGET NAME FORMAT)
+        cmake_parse_arguments(BAKE "" "" "BAKE_OPTIONS" ${ARGN})
+
+        if(TARGET qdbmp-bake)
+                set(BAKE_TOOL $<TARGET_FILE:qdbmp-bake>)
+                set(BAKE_DEPENDS qdbmp-bake)
+        elseif(QDBMP_BAKE)
+                set(BAKE_TOOL ${QDBMP_BAKE})
+                set(BAKE_DEPENDS ${QDBMP_BAKE})
+        else()
+                find_program(QDBMP_BAKE_PROGRAM qdbmp-bake)
+                if(NOT QDBMP_BAKE_PROGRAM)
+                        message(FATAL_ERROR "add_baked_assets: qdbmp-bake not found, build tools/ and set QDBMP_BAKE")
+                endif()
+                set(BAKE_TOOL ${QDBMP_BAKE_PROGRAM})
+                set(BAKE_DEPENDS ${QDBMP_BAKE_PROGRAM})
+        endif()
+
+        set(BAKE_ASSETS "")
+        foreach(ASSET ${BAKE_UNPARSED_ARGUMENTS})
+                get_filename_component(ASSET ${ASSET} ABSOLUTE)
+                list(APPEND BAKE_ASSETS ${ASSET})
+        endforeach()
+
+        set(BAKE_OUT ${CMAKE_CURRENT_BINARY_DIR}/${NAME}_assets)
+        add_custom_command(OUTPUT ${BAKE_OUT}.c ${BAKE_OUT}.h
+                COMMAND ${BAKE_TOOL} -n ${NAME} -f ${FORMAT} ${BAKE_BAKE_OPTIONS} -o ${BAKE_OUT}.c -H ${BAKE_OUT}.h ${BAKE_ASSETS}
+                DEPENDS ${BAKE_ASSETS} ${BAKE_DEPENDS}
+                COMMENT "Baking ${NAME} assets"
+                VERBATIM)
+        target_sources(${TARGET} PRIVATE ${BAKE_OUT}.c ${BAKE_OUT}.h)
+        target_include_directories(${TARGET} PRIVATE ${CMAKE_CURRENT_BINARY_DIR})
+endfunction()
@@ -0,0 +1,257 @@
+#ifndef _QDBMP_HPP_
+#define _QDBMP_HPP_
+
+/*
+**
+** Header-only C++17 layer over the QDBMP decode kernels: a move-only image owning its pixels,
+** allocated from a std::pmr::memory_resource, non-owning strided views, and a parsed source
+** reading rows in place from the caller's buffer. Errors are thrown as qdbmp::error with their
+** BMP_STATUS; the decode path returns statuses directly and does not depend on the global error
+** state of the legacy BMP_* API. Link with qdbmp_core.c.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+extern "C"
+{
+#include "qdbmp_core.h"
+}
+
+#include <cstddef>
+#include <memory_resource>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace qdbmp
+{
+
+/* Error of a QDBMP operation */
+class error : public std::runtime_error
+{
+public:
+	explicit error( BMP_STATUS status ) : std::runtime_error( StatusDescription( status ) ), status_( status ) {}
+	BMP_STATUS status() const noexcept { return status_; }
+
+private:
+	BMP_STATUS status_;
+};
+
+inline void check( BMP_STATUS status )
+{
+	if ( status != BMP_OK ) throw error( status );
+}
+
+
+/* Decoded pixel formats, the value is the pixel size in bytes */
+enum class format : u32
+{
+	grey = 1,	/* 8-bit BT.601 luma, palette entries for indexed images */
+	rgbx = 4,	/* R, G, B and opaque alpha */
+};
+
+constexpr u32 pixel_size( format fmt ) noexcept { return static_cast< u32 >( fmt ); }
+
+
+/* Non-owning view of pixels of a format, rows being stride bytes apart. A negative stride
+views bottom-up buffers without copying. T is u8, or const u8 for read-only views. */
+template< class T >
+class basic_view
+{
+public:
+	basic_view() noexcept = default;
+	basic_view( T* data, u32 width, u32 height, std::ptrdiff_t stride, format fmt ) noexcept
+		: data_( data ), width_( width ), height_( height ), stride_( stride ), format_( fmt ) {}
+	/* Tightly packed rows */
+	basic_view( T* data, u32 width, u32 height, format fmt ) noexcept
+		: basic_view( data, width, height, static_cast< std::ptrdiff_t >( width ) * pixel_size( fmt ), fmt ) {}
+
+	/* Mutable views convert to read-only ones */
+	template< class U, class = std::enable_if_t< std::is_convertible_v< U*, T* > > >
+	basic_view( const basic_view< U >& v ) noexcept
+		: data_( v.data() ), width_( v.width() ), height_( v.height() ), stride_( v.stride() ), format_( v.pixel_format() ) {}
+
+	T* data() const noexcept { return data_; }
+	u32 width() const noexcept { return width_; }
+	u32 height() const noexcept { return height_; }
+	std::ptrdiff_t stride() const noexcept { return stride_; }
+	format pixel_format() const noexcept { return format_; }
+	bool empty() const noexcept { return !data_ || !width_ || !height_; }
+
+	T* row( u32 y ) const noexcept { return data_ + static_cast< std::ptrdiff_t >( y ) * stride_; }
+
+	/* View of a region, which must lie within this view */
+	basic_view sub( u32 x, u32 y, u32 w, u32 h ) const
+	{
+		if ( x > width_ || w > width_ - x || y > height_ || h > height_ - y )
+			throw error( BMP_INVALID_ARGUMENT );
+		return basic_view( row( y ) + static_cast< std::ptrdiff_t >( x ) * pixel_size( format_ ), w, h, stride_, format_ );
+	}
+
+private:
+	T *data_ = nullptr;
+	u32 width_ = 0, height_ = 0;
+	std::ptrdiff_t stride_ = 0;
+	format format_ = format::rgbx;
+};
+
+using view = basic_view< u8 >;
+using const_view = basic_view< const u8 >;
+
+
+/* BMP frame parsed from a buffer the caller keeps alive; rows are read in place */
+class source
+{
+public:
+	source( const void* data, std::size_t size, format fmt = format::rgbx )
+		: data_( static_cast< const u8* >( data ) ), size_( size ), format_( fmt )
+	{
+		check( ReadSource( data_, size_, 0, ( fmt == format::grey ) ? 1 : 0, &src_ ) );
+		check( LocateRows( &src_, data_, size_ ) );
+	}
+
+	u32 width() const noexcept { return src_.width; }
+	u32 height() const noexcept { return src_.height; }
+	USHORT bpp() const noexcept { return src_.bpp; }
+	format pixel_format() const noexcept { return format_; }
+	const QDBMPSource& native() const noexcept { return src_; }
+
+	/* Restricts the frame to a region, clamped to the image. 1 and 4 BPP regions start on a byte. */
+	source& crop( u32 x, u32 y, u32 w, u32 h )
+	{
+		check( CropSource( &src_, x, y, w, h ) );
+		check( LocateRows( &src_, data_, size_ ) );
+		return *this;
+	}
+
+	/* Stored row y, top row first */
+	const u8* raw_row( u32 y ) const noexcept { return BMP_SOURCE_ROW( &src_, y ); }
+
+	/* Decodes row y into width() pixels of the source format */
+	void decode_row( u8* dst, u32 y ) const noexcept
+	{
+		if ( format_ == format::grey )
+			GreyRow( dst, raw_row( y ), src_.width, src_.bpp, src_.grey_lut, 0, 1 );
+		else
+			ColorRow( dst, raw_row( y ), src_.width, src_.bpp, src_.color_lut );
+	}
+
+	/* Decodes the frame into the top-left corner of dst, which must be large enough and of the source format */
+	void decode( view dst ) const
+	{
+		if ( dst.pixel_format() != format_ || dst.width() < src_.width || dst.height() < src_.height || !dst.data() )
+			throw error( BMP_INVALID_ARGUMENT );
+		for ( u32 y = 0; y < src_.height; y++ )
+			decode_row( dst.row( y ), y );
+	}
+
+private:
+	QDBMPSource src_;
+	const u8 *data_;
+	std::size_t size_;
+	format format_;
+};
+
+
+/* Image owning tightly packed pixels allocated from a memory resource. Move-only. */
+class image
+{
+public:
+	/* Pixel buffers are aligned for vector loads and stores */
+	static constexpr std::size_t alignment = 64;
+
+	image() noexcept = default;
+	image( u32 width, u32 height, format fmt, std::pmr::memory_resource* mr = std::pmr::get_default_resource() )
+		: mr_( mr ), width_( width ), height_( height ), format_( fmt )
+	{
+		u64 size = static_cast< u64 >( width ) * height * pixel_size( fmt );
+		if ( size != static_cast< std::size_t >( size ) )
+			throw error( BMP_OUT_OF_MEMORY );
+		size_ = static_cast< std::size_t >( size );
+		if ( size_ )
+			data_ = static_cast< u8* >( mr_->allocate( size_, alignment ) );
+	}
+
+	image( image&& o ) noexcept
+		: mr_( o.mr_ ), data_( std::exchange( o.data_, nullptr ) ), size_( std::exchange( o.size_, 0 ) ),
+		width_( std::exchange( o.width_, 0 ) ), height_( std::exchange( o.height_, 0 ) ), format_( o.format_ ) {}
+
+	image& operator=( image&& o ) noexcept
+	{
+		if ( this != &o )
+		{
+			reset();
+			mr_ = o.mr_;
+			data_ = std::exchange( o.data_, nullptr );
+			size_ = std::exchange( o.size_, 0 );
+			width_ = std::exchange( o.width_, 0 );
+			height_ = std::exchange( o.height_, 0 );
+			format_ = o.format_;
+		}
+		return *this;
+	}
+
+	image( const image& ) = delete;
+	image& operator=( const image& ) = delete;
+	~image() { reset(); }
+
+	/* Frees the pixels */
+	void reset() noexcept
+	{
+		if ( data_ ) mr_->deallocate( data_, size_, alignment );
+		data_ = nullptr;
+		size_ = 0;
+		width_ = height_ = 0;
+	}
+
+	u8* data() noexcept { return data_; }
+	const u8* data() const noexcept { return data_; }
+	std::size_t size() const noexcept { return size_; }
+	u32 width() const noexcept { return width_; }
+	u32 height() const noexcept { return height_; }
+	format pixel_format() const noexcept { return format_; }
+	std::pmr::memory_resource* resource() const noexcept { return mr_; }
+
+	view pixels() noexcept { return view( data_, width_, height_, format_ ); }
+	const_view pixels() const noexcept { return const_view( data_, width_, height_, format_ ); }
+	operator view() noexcept { return pixels(); }
+	operator const_view() const noexcept { return pixels(); }
+
+private:
+	std::pmr::memory_resource *mr_ = std::pmr::get_default_resource();
+	u8 *data_ = nullptr;
+	std::size_t size_ = 0;
+	u32 width_ = 0, height_ = 0;
+	format format_ = format::rgbx;
+};
+
+
+/* Decodes a frame into an image allocated from mr */
+inline image decode( const source& src, std::pmr::memory_resource* mr = std::pmr::get_default_resource() )
+{
+	image img( src.width(), src.height(), src.pixel_format(), mr );
+	src.decode( img.pixels() );
+	return img;
+}
+
+inline image decode( const void* data, std::size_t size, format fmt = format::rgbx, std::pmr::memory_resource* mr = std::pmr::get_default_resource() )
+{
+	return decode( source( data, size, fmt ), mr );
+}
+
+/* Decodes a frame into caller memory, such as an output packet, without allocating */
+inline void decode( const void* data, std::size_t size, view dst )
+{
+	source( data, size, dst.pixel_format() ).decode( dst );
+}
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _QDBMP_ASYNC_H_
+#define _QDBMP_ASYNC_H_
+
+/*
+**
+** Asynchronous BMP decoding for native services: jobs are submitted without blocking, decoded by
+** the process-wide thread pool and completed through a callback, polling or waiting.
+** Requires POSIX threads and qdbmp_pool.c.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+
+
+/* Pixels decoded by a pool task: frames above twice this are split into bands of rows, smaller
+frames are grouped into tasks of about this size */
+#define ASYNC_TASK_PIXELS	( 1u << 18 )
+
+/* Decoder owning a queue of jobs, typically one per service */
+typedef struct _AsyncDecoder AsyncDecoder;
+
+/* Submitted job, freed with AsyncJobFree once complete */
+typedef struct _AsyncJob AsyncJob;
+
+/* Completion callback, called on a pool thread once the pixels are decoded or the job failed */
+typedef void ( *AsyncCallback )( void* udta, AsyncJob* job, BMP_STATUS status );
+
+
+AsyncDecoder*	AsyncOpen					( Bool realtime );
+void			AsyncClose					( AsyncDecoder* d );
+
+AsyncJob*		AsyncSubmit					( AsyncDecoder* d, const u8* data, u64 size, u8* dst, u32 dst_stride, u64 dst_size, u32 pixel_size, AsyncCallback cb, void* udta );
+Bool			AsyncPoll					( AsyncJob* job, BMP_STATUS* status );
+BMP_STATUS		AsyncWait					( AsyncJob* job );
+const u8*		AsyncJobPixels				( const AsyncJob* job, u32* width, u32* height, u32* stride );
+void			AsyncJobFree				( AsyncJob* job );
+
+#endif
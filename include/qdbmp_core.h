@@ -0,0 +1,205 @@
+#ifndef _QDBMP_CORE_H_
+#define _QDBMP_CORE_H_
+
+/*
+**
+** BMP parsing, row conversion kernels and QOI codec shared by the QDBMP filter and the native tools.
+** This part does not depend on GPAC and builds with any C99 compiler.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp.h"
+
+#include <string.h>
+
+/* GPAC base types, for builds without the GPAC headers */
+#ifndef _GF_SETUP_H_
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef double Double;
+typedef enum
+{
+	GF_FALSE = 0,
+	GF_TRUE
+} Bool;
+
+#ifndef MIN
+#define MIN( X, Y ) ( ( X ) < ( Y ) ? ( X ) : ( Y ) )
+#endif
+#ifndef MAX
+#define MAX( X, Y ) ( ( X ) > ( Y ) ? ( X ) : ( Y ) )
+#endif
+#endif
+
+
+/* Size of the palette data for 8 BPP bitmaps */
+#define BMP_PALETTE_SIZE_8bpp ( 256 * 4 )
+
+/* Size of the palette data for 4 BPP bitmaps */
+#define BMP_PALETTE_SIZE_4bpp ( 16 * 4 )
+
+/* Size of the palette data for 1 BPP bitmaps */
+#define BMP_PALETTE_SIZE_1bpp ( 2 * 4 )
+
+/* Size of the file header and BITMAPINFOHEADER of the BMP files written */
+#define BMP_HEADER_SIZE	54
+
+/* Size of the red, green and blue masks following the header of 16 BPP (BI_BITFIELDS) files */
+#define BMP_MASKS_SIZE	12
+
+/* Encoding flags: 16 BPP pixels are 565 unless BMP_ENCODE_555 is set, BMP_ENCODE_DITHER
+applies a 4x4 ordered dither before the reduction */
+#define BMP_ENCODE_555		0x1
+#define BMP_ENCODE_DITHER	0x2
+
+/* Size in bytes of a row of pixel data, rows are padded to 4 bytes */
+#define BMP_ROW_STRIDE( width, bpp ) ( ( ( ( width ) * ( bpp ) + 31 ) / 32 ) * 4 )
+
+/* Minimum luma spread of an Otsu tile, flatter tiles use the global threshold */
+#define BMP_OTSU_MIN_SPREAD	32
+
+/* Size of the tar header and data blocks */
+#define TAR_BLOCK_SIZE	512
+
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF		0x40
+#define QOI_OP_LUMA		0x80
+#define QOI_OP_RUN		0xC0
+#define QOI_OP_RGB		0xFE
+#define QOI_OP_RGBA		0xFF
+#define QOI_MASK_2		0xC0
+#define QOI_HEADER_SIZE	14
+#define QOI_END_SIZE	8
+#define QOI_MAX_RUN		62
+#define QOI_HASH( px )	( ( ( px )[ 0 ] * 3 + ( px )[ 1 ] * 5 + ( px )[ 2 ] * 7 + ( px )[ 3 ] * 11 ) % 64 )
+
+/* Slots of the color table, twice the largest palette so probe sequences stay short */
+#define BMP_COLOR_SLOTS	512
+
+
+/* Pixel data of the frame being decoded */
+typedef struct
+{
+	const u8 *pixels;
+	/* Position and size of the pixel data in the file, restricted to the rows and columns of a region by CropSource */
+	u64 data_offset, data_size;
+	u32 width, height;
+	/* Distance in bytes between two rows of pixels */
+	u32 stride;
+	USHORT bpp;
+	Bool top_down;
+	/* greyscale value and RGBX color of each palette entry, for indexed images */
+	u8 grey_lut[ 256 ];
+	u8 color_lut[ 256 * 4 ];
+} QDBMPSource;
+
+/* Returns the address of output row y in the source pixel data; BMP rows are stored bottom-up unless the height is negative */
+#define BMP_SOURCE_ROW( src, y ) \
+	( ( src )->pixels + (u64) ( ( src )->top_down ? ( y ) : ( src )->height - 1 - ( y ) ) * ( src )->stride )
+
+/* Regular file member of an uncompressed tar archive */
+typedef struct
+{
+	/* Offset of the first header of the member, including its GNU long name and pax headers */
+	u64 header;
+	/* Offset and size of the member data */
+	u64 offset, size;
+	/* Modification time since the epoch */
+	s64 mtime;
+	u32 mtime_ns;
+} TarMember;
+
+/* QOI encoder / decoder state */
+typedef struct
+{
+	u8 index[ 64 * 4 ];
+	u8 prev[ 4 ];
+	u32 run;
+	/* Decoder read position in the input */
+	u32 pos;
+} QOIState;
+
+
+/* Distinct RGBX colors of a frame, in an open-addressing hash table with linear probing */
+typedef struct
+{
+	/* Palette index plus one of the color in each slot, 0 for free slots */
+	u16 slots[ BMP_COLOR_SLOTS ];
+	/* Colors in order of appearance, as read from the RGBX pixels; more than 256 colors stop the count */
+	u32 colors[ 256 ];
+	u32 nb_colors;
+} QDBMPColorTable;
+
+
+/* Byte position of each channel in the BGRX pixel and palette layout, indexed by the channel option */
+extern const u32 BMP_CHANNEL_OFFSET[ 5 ];
+
+/* 8-bit fixed point luma weights (B, G, R), indexed by the grey option; each set sums to 256 */
+extern const u32 BMP_LUMA_WEIGHTS[ 3 ][ 3 ];
+
+
+/* Header I/O */
+int				ReadUINT					( UINT* x, FILE* f );
+int				ReadUSHORT					( USHORT* x, FILE* f );
+int				WriteUINT					( UINT x, FILE* f );
+int				WriteUSHORT					( USHORT x, FILE* f );
+int				ReadHeader					( BMP* bmp, FILE* f );
+
+/* In-memory frames */
+BMP_STATUS		ReadSource					( const u8* data, u64 size, u32 channel, u32 grey, QDBMPSource* src );
+BMP_STATUS		CropSource					( QDBMPSource* src, u32 x, u32 y, u32 w, u32 h );
+BMP_STATUS		LocateRows					( QDBMPSource* src, const u8* data, u64 size );
+const char*		StatusDescription			( BMP_STATUS status );
+
+/* Tar archives */
+Bool			IsTarArchive				( const u8* data, u64 size );
+int				TarNextMember				( const u8* data, u64 size, u64* pos, TarMember* m );
+u32				TarMemberName				( const u8* data, u64 size, const TarMember* m, char* name, u32 max );
+
+/* Row conversion */
+void			ExtractChannelRow			( u8* dst, const u8* src, u32 width, USHORT bpp, u32 offset );
+void			LumaRow						( u8* dst, const u8* src, u32 width, USHORT bpp, const u32* w );
+void			LookupRow					( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut );
+void			GreyRow						( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut, u32 channel, u32 grey );
+void			ColorRow					( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut );
+void			ScaleColorRow				( u8* dst, const u8* src, u32 width, u32 src_width, USHORT bpp, const u8* lut );
+void			PadRow						( u8* row, u32 width, u32 left, u32 right, u32 pixel_size );
+void			TileRow						( u8* band, const u8* row, u32 width, u32 y, u32 tile, Bool morton, u32 pixel_size );
+
+/* BMP encoding */
+u32				BuildHeader					( u8* out, u32 width, u32 height, USHORT bpp, u32 flags );
+void			EncodeRow					( u8* dst, const u8* src, u32 width, u32 pixel_size, USHORT bpp, u32 flags, u32 y );
+u64				RowHash						( const u8* data, u32 size );
+
+/* Binarization */
+u32				OtsuThreshold				( const u32* hist, u32 fallback );
+void			PackRow						( u8* dst, const u8* grey, u32 width, const u32* thresh, u32 tile_w );
+
+/* Palette reduction */
+void			ColorTableReset				( QDBMPColorTable* t );
+Bool			CountColorsRow				( QDBMPColorTable* t, const u8* row, u32 width );
+void			IndexRow					( u8* dst, const u8* row, u32 width, const QDBMPColorTable* t, u32 bits );
+
+/* QOI codec */
+u8*				QOIStart					( QOIState* s, u8* out, u32 width, u32 height, u8 channels );
+u8*				QOIEncodeRow				( QOIState* s, u8* out, const u8* px, u32 width );
+u8*				QOIFinish					( QOIState* s, u8* out );
+void			QOIDecodeStart				( QOIState* s );
+int				QOIDecodeRow				( QOIState* s, u8* dst, u32 width, const u8* in, u32 size );
+
+#endif
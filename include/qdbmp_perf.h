@@ -0,0 +1,48 @@
+#ifndef _QDBMP_PERF_H_
+#define _QDBMP_PERF_H_
+
+/*
+**
+** Per-thread performance counters for instrumenting the native decode stages, on top of Linux
+** perf_event_open. Hardware events are used when permitted, software events otherwise.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+
+
+/* Counters of a set: cycles, instructions, LLC, dTLB and branch misses with hardware events,
+task clock in ns, context switches, CPU migrations, page faults and major faults otherwise */
+#define PERF_NB_COUNTERS	5
+
+/* Counters of the calling thread */
+typedef struct
+{
+	/* Event file descriptors, -1 for events that could not be opened */
+	int fds[ PERF_NB_COUNTERS ];
+	/* Software events replace hardware ones that are not permitted or not supported */
+	Bool software;
+} PerfCounters;
+
+/* Counter values, or the difference between two readings */
+typedef struct
+{
+	u64 values[ PERF_NB_COUNTERS ];
+} PerfSample;
+
+
+void			PerfOpen					( PerfCounters* pc );
+void			PerfClose					( PerfCounters* pc );
+void			PerfRead					( const PerfCounters* pc, PerfSample* s );
+void			PerfAdd						( PerfSample* total, const PerfSample* start, const PerfSample* end );
+const char*		PerfCounterName				( Bool software, u32 counter );
+
+#endif
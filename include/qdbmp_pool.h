@@ -0,0 +1,40 @@
+#ifndef _QDBMP_POOL_H_
+#define _QDBMP_POOL_H_
+
+/*
+**
+** Process-wide thread pool running the band and frame tasks of every QDBMP user in the process,
+** for the native library and tools. The GPAC filter runs on the session scheduler and does not use
+** it. Requires POSIX threads.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+
+
+/* Task of a run: index is the task number in the run, thread the pool thread running it, or
+PoolSize() for the thread that submitted the run when it is not a pool thread */
+typedef void ( *PoolTask )( void* arg, u32 index, u32 thread );
+
+/* Submitter of runs, typically one per decoder instance. Groups with pending tasks are served
+in turn, realtime groups first. */
+typedef struct _PoolGroup PoolGroup;
+
+
+u32				PoolStart					( u32 nb_threads );
+u32				PoolSize					( void );
+void			PoolStop					( void );
+
+PoolGroup*		PoolGroupNew				( Bool realtime );
+void			PoolGroupDel				( PoolGroup* g );
+void			PoolRun						( PoolGroup* g, PoolTask task, void* arg, u32 count );
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _QDBMP_TRACE_H_
+#define _QDBMP_TRACE_H_
+
+/*
+**
+** Offline trace of the native decode activity: spans recorded per thread and written as a
+** Chrome trace-event JSON file, viewable in chrome://tracing or Perfetto. Requires POSIX threads.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+
+
+/* Set by TraceStart; spans are only recorded while set */
+extern Bool TraceEnabled;
+
+
+void			TraceStart					( void );
+u64				TraceNow					( void );
+void			TraceThreadName				( const char* name, s32 index );
+void			TraceSpan					( const char* name, const char* detail, u64 start, u64 end );
+Bool			TraceWrite					( const char* path );
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _QDBMP_WRITER_H_
+#define _QDBMP_WRITER_H_
+
+/*
+**
+** Native BMP file writer on top of the QDBMP encoding kernels, for the command-line tools.
+** Requires POSIX positional I/O and mmap, and qdbmp_pool.c.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+#include "qdbmp_pool.h"
+
+
+/* Rows encoded and written with a single call, and rows encoded by a pool task */
+#define WRITER_BAND_ROWS	64
+
+/* Frames written whole from this size are encoded in parallel into the mapped file */
+#define WRITER_PARALLEL_MIN	( 8u << 20 )
+
+/* BMP file kept open across frames. Frames with the geometry of the
+previous one only rewrite the rows that changed, detected from the
+hash of each encoded row. */
+typedef struct
+{
+	int fd;
+	/* Header and palette of the file */
+	u8 header[ BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp ];
+	u32 header_size;
+	u32 width, height, row_size;
+	/* Hash of each row of the file, in file order (bottom-up); NULL until the file content is known */
+	u64 *hashes;
+	/* Encoded rows waiting to be written, in file order */
+	u8 *band;
+	/* Bytes and write calls issued */
+	u64 nb_bytes, nb_writes;
+	/* Pool group encoding large frames written whole, NULL to encode them on the calling thread */
+	PoolGroup *pool;
+} QDBMPWriter;
+
+
+QDBMPWriter*	WriterOpen					( const char* path );
+BMP_STATUS		WriterUpdate				( QDBMPWriter* w, const u8* pixels, u32 width, u32 height, u32 stride, u32 pixel_size, USHORT bpp, u32 flags );
+void			WriterClose					( QDBMPWriter* w );
+
+BMP_STATUS		WriteBMPFile				( const char* path, const u8* pixels, u32 width, u32 height, u32 stride, u32 pixel_size, USHORT bpp, u32 flags, PoolGroup* pool );
+
+#endif
@@ -3,7 +3,7 @@
 ** Adapted from the qdbmp code; see QDBMP license information below
 **
 ** This is a starting point for full BMP support. Currently, this reads in the palette and handles
-** 32, 24, and 8bpp (non-indexed) to RGBA format. Later implementations should handle other, less popular, BMP versions.
+** uncompressed 32, 24, 8, 4 and 1bpp to RGBX, greyscale or packed 1bpp format. Later implementations should handle other, less popular, BMP versions.
 **
 **
 ** This file is part of Bevara Access Filters.
@@ -16,150 +16,350 @@
 */
 
 #include <gpac/filters.h>
-#include "qdbmp.h"
+#include <gpac/thread.h>
+#include "qdbmp_core.h"
 
 #include <stdio.h>
 
+/* Scrub cache frame, shared with the output packets showing it */
+typedef struct
+{
+	u8 *data;
+	u32 size;
+	u64 cts;
+	u32 dur;
+	u32 codecid, pixfmt, width, height, stride, vis_w, vis_h;
+	/* Source byte offset following the input frame, GF_FILTER_NO_BO if unknown */
+	u64 next_offset;
+	/* Indexed frames: RGBX colors of the palette */
+	u32 nb_colors;
+	u32 palette[ 256 ];
+	/* Output packets still holding the frame */
+	u32 refs;
+	/* Frames are ready once decoded; evicted frames are freed when their last packet is released */
+	Bool ready, evicted;
+} QDBMPCachedFrame;
+
 typedef struct
 {
 	GF_FilterPid *ipid, *opid;
 	Bool is_playing;
 	Bool initial_play_done;
+
+	//options
+	u32 channel, grey, bin, thresh, bintile;
+	u32 padw, padh, border;
+	u32 roix, roiy, roiw, roih;
+	u32 tile;
+	Bool morton;
+	u32 maxpix, maxbytes, maxtime;
+	Double maxratio;
+	Bool qoi, indexed;
+	u32 cache;
+
+	u32 mosaic, cellw, cellh;
+	GF_Fraction fps;
+
+	/* Mosaic mode: input PID of each cell, NULL for free cells */
+	GF_FilterPid **cells;
+	u32 nb_cells;
+	/* Mosaic mode: output frame shared with the output packets, written in place */
+	u8 *canvas;
+	u32 canvas_w, canvas_h;
+	volatile Bool canvas_in_use;
+
+	/* Resource limit rejection counters */
+	u32 nb_rej_pix, nb_rej_bytes, nb_rej_time, nb_rej_ratio;
+	/* Decode start time of the current frame, in microseconds */
+	u64 frame_start;
+
+	/* Tiled output: row converted before being stored into its tiles */
+	u8 *tile_row;
+	u32 tile_row_size;
+
+	/* Indexed output: colors counted while decoding, and palette size of the last frame, 0 when not indexed */
+	QDBMPColorTable colors;
+	u32 palette_size;
+
+	/* Scrub cache: cached frames, guarded by cache_mx as packets are released from any thread */
+	QDBMPCachedFrame **frames;
+	u32 nb_frames;
+	u64 cache_bytes;
+	GF_Mutex *cache_mx;
+	/* Scrub cache: frame being decoded */
+	QDBMPCachedFrame *pending;
+	/* Scrub cache: last shown timestamp and scrub direction, in input timescale */
+	u32 timescale;
+	u64 playhead;
+	Bool scrub_back;
+	/* Scrub cache: frames before decode_from are skipped, frames before play_from are only cached */
+	u64 decode_from, play_from;
+	/* Scrub cache: timestamp of the next frame served from the cache after a seek, and source
+	byte offset following the last served frame */
+	Bool serving;
+	u64 serve_cts, serve_offset;
+	u32 last_size, last_dur;
+	/* Scrub cache: the source, seeked when serving starts, prefetches into the cache while cached
+	frames are served; source_cts follows the last input frame, input_offset the current packet */
+	Bool prefetch;
+	u64 source_cts, input_offset;
+
+	/* Tar archive mode: archive packet, kept while its members are decoded in place, and its BMP and QOI members */
+	GF_FilterPacket *archive;
+	TarMember *members;
+	u32 nb_members, alloc_members;
+	/* Tar archive mode: next member to decode */
+	u32 member;
+
+	/* Byte-range mode: with a region on a BMP source of known size, only the header and the
+	region rows are fetched, through source seeks with start and end offsets */
+	Bool ranged;
+	u32 range_state;
+	u64 file_size;
+	QDBMPSource range_src;
+	/* Byte-range mode: file offset following the last input packet */
+	u64 range_pos;
+	/* Byte-range mode: header, then region rows packed in file order, and the next byte to gather */
+	u8 *range_buf;
+	u32 range_alloc;
+	u32 range_row, range_fill, range_row_size;
+	/* Byte-range mode: end of the rows of the current request, and bytes received for the frame */
+	u32 range_end_row;
+	u64 range_bytes;
 } GF_QDBMPCtx;
 
-/* Size of the palette data for 8 BPP bitmaps */
-#define BMP_PALETTE_SIZE_8bpp ( 256 * 4 )
+/* Packed 1 BPP monochrome output, MSB first, set bits are white; GPAC has no such pixel format */
+#define QDBMP_PIXEL_MONO	GF_4CC('M','O','N','1')
 
-/* Size of the palette data for 4 BPP bitmaps */
-#define BMP_PALETTE_SIZE_4bpp ( 16 * 4 )
+/* 8 BPP and packed 4 BPP (high nibble first) palette indices, with the RGBX palette in QDBMP_PROP_PALETTE;
+GPAC has no paletted pixel formats */
+#define QDBMP_PIXEL_PAL8	GF_4CC('P','A','L','8')
+#define QDBMP_PIXEL_PAL4	GF_4CC('P','A','L','4')
+#define QDBMP_PROP_PALETTE	GF_4CC('Q','P','A','L')
 
-/* Holds the last error code */
-static BMP_STATUS BMP_LAST_ERROR_CODE = BMP_OK;
+/* QOI lossless image codec, see https://qoiformat.org/qoi-specification.pdf; GPAC has no codec ID for it */
+#define QDBMP_CODECID_QOI	GF_4CC('Q','O','I','F')
 
+/* Tiled output geometry: tile size in pixels, tiles per row and pixel order within the tiles (0: rows, 1: Z order) */
+#define QDBMP_PROP_TILE_SIZE	GF_4CC('Q','T','S','Z')
+#define QDBMP_PROP_TILE_COLS	GF_4CC('Q','T','C','L')
+#define QDBMP_PROP_TILE_ORDER	GF_4CC('Q','T','O','R')
 
+/* Bytes requested for the header and palette in byte-range mode */
+#define QDBMP_RANGE_HEADER_SIZE	( BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp )
 
+/* Region rows closer than this in the file are fetched with a single request, skipped bytes included */
+#define QDBMP_RANGE_MAX_GAP	( 64 * 1024 )
 
-/**************************************************************
-	Reads a little-endian unsigned int from the file.
-	Returns non-zero on success.
-**************************************************************/
-int	ReadUINT( UINT* x, FILE* f )
+/* Byte-range mode states */
+enum
 {
-	UCHAR little[ 4 ];	/* BMPs use 32 bit ints */
+	QDBMP_RANGE_HEADER = 0,
+	QDBMP_RANGE_ROWS,
+	QDBMP_RANGE_DONE,
+};
 
-	if ( x == NULL || f == NULL )
-	{
-		return 0;
-	}
+/* Binarization modes */
+enum
+{
+	BMP_BIN_NONE = 0,
+	BMP_BIN_GLOBAL,
+	BMP_BIN_OTSU,
+};
 
-	if ( fread( little, 4, 1, f ) != 1 )
-	{
-		return 0;
+static const char * QDBMP_probe_data(const u8 *data, u32 size, GF_FilterProbeScore *score)
+{
+	if ((size >= 54) && (data[0] == 'B') && (data[1] == 'M')) {
+		*score = GF_FPROBE_SUPPORTED;
+		return "image/bmp";
 	}
-
-	*x = ( little[ 3 ] << 24 | little[ 2 ] << 16 | little[ 1 ] << 8 | little[ 0 ] );
-
-	return 1;
+	if ((size >= QOI_HEADER_SIZE + QOI_END_SIZE) && !memcmp(data, "qoif", 4)) {
+		*score = GF_FPROBE_SUPPORTED;
+		return "image/qoi";
+	}
+	/* Archives may hold other files than images */
+	if (IsTarArchive(data, size)) {
+		*score = GF_FPROBE_MAYBE_SUPPORTED;
+		return "application/x-tar";
+	}
+	return NULL;
 }
 
+/* Releases the current tar archive */
+static void QDBMP_close_archive(GF_QDBMPCtx *ctx)
+{
+	if ( ctx->archive ) gf_filter_pck_unref( ctx->archive );
+	ctx->archive = NULL;
+	ctx->nb_members = ctx->member = 0;
+}
 
 /**************************************************************
-	Reads a little-endian unsigned short int from the file.
-	Returns non-zero on success.
+	Indexes the BMP and QOI members of a tar archive in one pass
+	over its headers, in archive order. The archive packet is
+	kept so that members are decoded from it in place, one frame
+	per member at the fps rate.
 **************************************************************/
-int	ReadUSHORT( USHORT *x, FILE* f )
+static GF_Err QDBMP_open_archive(GF_QDBMPCtx *ctx, GF_FilterPacket *pck, const u8 *data, u32 size)
 {
-	UCHAR little[ 2 ];	/* BMPs use 16 bit shorts */
+	TarMember m, *members;
+	u64 pos = 0;
+	const u8 *member;
+	int res;
 
-	if ( x == NULL || f == NULL )
+	QDBMP_close_archive( ctx );
+	while ( ( res = TarNextMember( data, size, &pos, &m ) ) == 1 )
 	{
-		return 0;
-	}
+		/* Other files, such as capture logs, are skipped */
+		member = data + m.offset;
+		if ( !( m.size >= 54 && member[ 0 ] == 'B' && member[ 1 ] == 'M' )
+			&& !( m.size >= QOI_HEADER_SIZE + QOI_END_SIZE && !memcmp( member, "qoif", 4 ) ) )
+			continue;
 
-	if ( fread( little, 2, 1, f ) != 1 )
-	{
-		return 0;
+		if ( ctx->nb_members == ctx->alloc_members )
+		{
+			u32 alloc = ctx->alloc_members ? 2 * ctx->alloc_members : 64;
+			members = gf_realloc( ctx->members, alloc * sizeof( TarMember ) );
+			if ( !members ) return GF_OUT_OF_MEM;
+			ctx->members = members;
+			ctx->alloc_members = alloc;
+		}
+		ctx->members[ ctx->nb_members++ ] = m;
 	}
+	if ( res < 0 )
+		GF_LOG(GF_LOG_WARNING, GF_LOG_CODEC, ("[QDBMP] Corrupted tar header at offset "LLU", ignoring the rest of the archive\n", pos));
+	if ( !ctx->nb_members )
+		return GF_NON_COMPLIANT_BITSTREAM;
+
+	gf_filter_pck_ref( &pck );
+	ctx->archive = pck;
+
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_TIMESCALE, &PROP_UINT(ctx->fps.num));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_FPS, &PROP_FRAC(ctx->fps));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_NB_FRAMES, &PROP_UINT(ctx->nb_members));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_DURATION, &PROP_FRAC64_INT((u64) ctx->nb_members * ctx->fps.den, ctx->fps.num));
+	ctx->timescale = ctx->fps.num;
+	return GF_OK;
+}
 
-	*x = ( little[ 1 ] << 8 | little[ 0 ] );
-
-	return 1;
+/**************************************************************
+	Sets the timing of a frame decoded from a tar member: the
+	member index at the fps rate, with the member path and its
+	modification time as UTC time.
+**************************************************************/
+static void QDBMP_set_member_props(GF_QDBMPCtx *ctx, GF_FilterPacket *dst_pck, const TarMember *m, u64 cts)
+{
+	char name[ 1024 ];
+	const u8 *data;
+	u32 size;
+
+	gf_filter_pck_set_cts( dst_pck, cts );
+	gf_filter_pck_set_duration( dst_pck, ctx->fps.den );
+	gf_filter_pck_set_sap( dst_pck, GF_FILTER_SAP_1 );
+	gf_filter_pck_set_property( dst_pck, GF_PROP_PCK_UTC_TIME, &PROP_LONGUINT( (u64) m->mtime * 1000 + m->mtime_ns / 1000000 ) );
+
+	data = gf_filter_pck_get_data( ctx->archive, &size );
+	if ( TarMemberName( data, size, m, name, sizeof( name ) ) )
+		gf_filter_pck_set_property( dst_pck, GF_PROP_PCK_FILENAME, &PROP_STRING( name ) );
 }
 
+/* Moves the archive to the member shown at cts, seeking is free in an indexed archive */
+static void QDBMP_seek_archive(GF_Filter *filter, GF_QDBMPCtx *ctx, u64 cts)
+{
+	ctx->member = (u32) MIN( cts / ctx->fps.den, ctx->nb_members );
+	gf_filter_post_process_task(filter);
+}
 
 /**************************************************************
-	Writes a little-endian unsigned int to the file.
-	Returns non-zero on success.
+	Byte-range mode: requests the next run of region rows, from
+	the current row to the end of the region or, when the rows
+	are too far apart in the file, to the end of the row.
 **************************************************************/
-int	WriteUINT( UINT x, FILE* f )
+static void QDBMP_range_request(GF_QDBMPCtx *ctx)
 {
-	UCHAR little[ 4 ];	/* BMPs use 32 bit ints */
+	const QDBMPSource *src = &ctx->range_src;
+	GF_FilterEvent fevt;
 
-	little[ 3 ] = (UCHAR)( ( x & 0xff000000 ) >> 24 );
-	little[ 2 ] = (UCHAR)( ( x & 0x00ff0000 ) >> 16 );
-	little[ 1 ] = (UCHAR)( ( x & 0x0000ff00 ) >> 8 );
-	little[ 0 ] = (UCHAR)( ( x & 0x000000ff ) >> 0 );
+	ctx->range_end_row = ( src->stride - ctx->range_row_size < QDBMP_RANGE_MAX_GAP ) ? src->height : ctx->range_row + 1;
 
-	return ( f && fwrite( little, 4, 1, f ) == 1 );
+	GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->ipid);
+	fevt.seek.start_offset = src->data_offset + (u64) ctx->range_row * src->stride + ctx->range_fill;
+	fevt.seek.end_offset = src->data_offset + (u64) ( ctx->range_end_row - 1 ) * src->stride + ctx->range_row_size;
+	gf_filter_pid_send_event(ctx->ipid, &fevt);
 }
 
-
-/**************************************************************
-	Writes a little-endian unsigned short int to the file.
-	Returns non-zero on success.
-**************************************************************/
-int	WriteUSHORT( USHORT x, FILE* f )
+/* Byte-range mode: starts a new frame by requesting the header */
+static void QDBMP_range_restart(GF_QDBMPCtx *ctx)
 {
-	UCHAR little[ 2 ];	/* BMPs use 16 bit shorts */
+	GF_FilterEvent fevt;
 
-	little[ 1 ] = (UCHAR)( ( x & 0xff00 ) >> 8 );
-	little[ 0 ] = (UCHAR)( ( x & 0x00ff ) >> 0 );
+	ctx->range_state = QDBMP_RANGE_HEADER;
+	ctx->range_fill = 0;
+	ctx->range_bytes = 0;
+	ctx->range_pos = 0;
 
-	return ( f && fwrite( little, 2, 1, f ) == 1 );
-};
+	GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->ipid);
+	fevt.seek.start_offset = 0;
+	fevt.seek.end_offset = QDBMP_RANGE_HEADER_SIZE;
+	gf_filter_pid_send_event(ctx->ipid, &fevt);
+}
 
 /**************************************************************
-	Reads the BMP file's header into the data structure.
-	Returns BMP_OK on success.
+	Mosaic mode: assigns each new input to the first free cell,
+	and frees the cell of removed inputs.
 **************************************************************/
-int	ReadHeader( BMP* bmp, FILE* f )
+static GF_Err QDBMP_configure_mosaic_pid(GF_Filter *filter, GF_FilterPid *pid, Bool is_remove)
 {
-	if ( bmp == NULL || f == NULL )
+	GF_QDBMPCtx *ctx = (GF_QDBMPCtx *)gf_filter_get_udta(filter);
+	u32 i, nb_inputs = 0;
+
+	for ( i = 0; i < ctx->nb_cells; i++ )
 	{
-		return BMP_INVALID_ARGUMENT;
+		if ( ctx->cells[ i ] == pid ) break;
 	}
 
-	/* The header's fields are read one by one, and converted from the format's
-	little endian to the system's native representation. */
-	if ( !ReadUSHORT( &( bmp->Header.Magic ), f ) )			return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.FileSize ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUSHORT( &( bmp->Header.Reserved1 ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUSHORT( &( bmp->Header.Reserved2 ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.DataOffset ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.HeaderSize ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.Width ), f ) )			return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.Height ), f ) )			return BMP_IO_ERROR;
-	if ( !ReadUSHORT( &( bmp->Header.Planes ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUSHORT( &( bmp->Header.BitsPerPixel ), f ) )	return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.CompressionType ), f ) )	return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.ImageDataSize ), f ) )	return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.HPixelsPerMeter ), f ) )	return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.VPixelsPerMeter ), f ) )	return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.ColorsUsed ), f ) )		return BMP_IO_ERROR;
-	if ( !ReadUINT( &( bmp->Header.ColorsRequired ), f ) )	return BMP_IO_ERROR;
+	if ( is_remove )
+	{
+		if ( i < ctx->nb_cells ) ctx->cells[ i ] = NULL;
+		for ( i = 0; i < ctx->nb_cells; i++ )
+		{
+			if ( ctx->cells[ i ] ) nb_inputs++;
+		}
+		if ( !nb_inputs && ctx->opid )
+		{
+			gf_filter_pid_remove(ctx->opid);
+			ctx->opid = NULL;
+		}
+		return GF_OK;
+	}
 
-	return BMP_OK;
-}
+	/* Reconfiguration of a known input */
+	if ( i < ctx->nb_cells )
+		return GF_OK;
 
-/*********************************** Public methods **********************************/
+	for ( i = 0; i < ctx->nb_cells; i++ )
+	{
+		if ( !ctx->cells[ i ] ) break;
+	}
+	if ( i == ctx->nb_cells )
+	{
+		GF_FilterPid **cells = gf_realloc( ctx->cells, ( ctx->nb_cells + 1 ) * sizeof( GF_FilterPid * ) );
+		if ( !cells ) return GF_OUT_OF_MEM;
+		ctx->cells = cells;
+		ctx->nb_cells++;
+	}
+	ctx->cells[ i ] = pid;
+	gf_filter_pid_set_framing_mode(pid, GF_TRUE);
 
-static const char * QDBMP_probe_data(const u8 *data, u32 size, GF_FilterProbeScore *score)
-{
-	if ((size >= 54) && (data[0] == 'B') && (data[1] == 'M')) {
-		*score = GF_FPROBE_SUPPORTED;
-		return "image/bmp";
+	if (!ctx->opid)
+	{
+		ctx->opid = gf_filter_pid_new(filter);
+		gf_filter_pid_copy_properties(ctx->opid, pid);
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CODECID, &PROP_UINT(GF_CODECID_RAW));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STREAM_TYPE, &PROP_UINT(GF_STREAM_VISUAL));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( GF_PIXEL_RGBX ));
+		gf_filter_set_name(filter, "QDBMP");
 	}
-	return NULL;
+	return GF_OK;
 }
 
 static GF_Err QDBMP_configure_pid(GF_Filter *filter, GF_FilterPid *pid, Bool is_remove)
@@ -167,6 +367,9 @@ static GF_Err QDBMP_configure_pid(GF_Filter *filter, GF_FilterPid *pid, Bool is_
 	const GF_PropertyValue *prop;
 	GF_QDBMPCtx *ctx = (GF_QDBMPCtx *)gf_filter_get_udta(filter);
 
+	if ( ctx->mosaic && is_remove )
+		return QDBMP_configure_mosaic_pid(filter, pid, GF_TRUE);
+
 	// disconnect of src pid (not yet supported)
 	if (is_remove)
 	{
@@ -175,19 +378,39 @@ static GF_Err QDBMP_configure_pid(GF_Filter *filter, GF_FilterPid *pid, Bool is_
 			gf_filter_pid_remove(ctx->opid);
 			ctx->opid = NULL;
 		}
+		QDBMP_close_archive( ctx );
 		ctx->ipid = NULL;
 		return GF_OK;
 	}
 	if (!gf_filter_pid_check_caps(pid))
 		return GF_NOT_SUPPORTED;
 
+	if ( ctx->mosaic )
+		return QDBMP_configure_mosaic_pid(filter, pid, GF_FALSE);
+
 	ctx->ipid = pid;
 
 	if (!ctx->opid)
 	{
 		ctx->opid = gf_filter_pid_new(filter);
 	}
-	gf_filter_pid_set_framing_mode(pid, GF_TRUE);
+
+	/* Regions of BMP files of known size are fetched by byte ranges, other inputs are received whole */
+	prop = gf_filter_pid_get_property(pid, GF_PROP_PID_DOWN_SIZE);
+	ctx->file_size = prop ? prop->value.longuint : 0;
+	ctx->ranged = GF_FALSE;
+	if ( ctx->roiw && ctx->roih && ctx->file_size )
+	{
+		prop = gf_filter_pid_get_property(pid, GF_PROP_PID_FILE_EXT);
+		if ( prop && prop->value.string && !stricmp( prop->value.string, "bmp" ) )
+			ctx->ranged = GF_TRUE;
+		prop = gf_filter_pid_get_property(pid, GF_PROP_PID_MIME);
+		if ( prop && prop->value.string && !strcmp( prop->value.string, "image/bmp" ) )
+			ctx->ranged = GF_TRUE;
+	}
+	gf_filter_pid_set_framing_mode(pid, ctx->ranged ? GF_FALSE : GF_TRUE);
+	if ( ctx->ranged )
+		QDBMP_range_restart( ctx );
 
 	// copy properties at init or reconfig
 	gf_filter_pid_copy_properties(ctx->opid, ctx->ipid);
@@ -199,331 +422,1593 @@ static GF_Err QDBMP_configure_pid(GF_Filter *filter, GF_FilterPid *pid, Bool is_
 	return GF_OK;
 }
 
-static Bool QDBMP_process_event(GF_Filter *filter, const GF_FilterEvent *evt)
+/**************************************************************
+	Announces the geometry of the next output frame. Padded
+	frames announce their vis_w x vis_h visible area as clean
+	aperture. A zero pixfmt keeps the current pixel format, a
+	zero stride removes it. Tiled frames have no stride and
+	announce their tile geometry instead. Indexed frames announce
+	their nb_colors palette entries.
+**************************************************************/
+static void QDBMP_set_frame_props(GF_QDBMPCtx *ctx, u32 codecid, u32 pixfmt, u32 w, u32 h, u32 stride, u32 vis_w, u32 vis_h, const u32 *palette, u32 nb_colors)
 {
-	GF_FilterEvent fevt;
-	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
-	if (evt->base.on_pid != ctx->opid) return GF_TRUE;
-	switch (evt->base.type) {
-	case GF_FEVT_PLAY:
-		if (ctx->is_playing) {
-			return GF_TRUE;
-		}
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CODECID, &PROP_UINT(codecid));
+	if ( pixfmt )
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, &PROP_UINT(pixfmt));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_WIDTH, &PROP_UINT(w));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_HEIGHT, &PROP_UINT(h));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STRIDE, stride ? &PROP_UINT(stride) : NULL);
+
+	if ( codecid == GF_CODECID_RAW && !stride && ctx->tile )
+	{
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_SIZE, &PROP_UINT(ctx->tile));
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_COLS, &PROP_UINT(w / ctx->tile));
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_ORDER, &PROP_UINT(ctx->morton ? 1 : 0));
+	}
+	else
+	{
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_SIZE, NULL);
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_COLS, NULL);
+		gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_TILE_ORDER, NULL);
+	}
+	gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_PALETTE, nb_colors ? &PROP_DATA( (u8 *) palette, nb_colors * 4 ) : NULL);
 
-		ctx->is_playing = GF_TRUE;
-		if (!ctx->initial_play_done) {
-			ctx->initial_play_done = GF_TRUE;
-			return GF_TRUE;
-		}
+	/* Offsets are from the frame center */
+	if ( w != vis_w || h != vis_h )
+	{
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_W, &PROP_FRAC_INT(vis_w, 1));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_H, &PROP_FRAC_INT(vis_h, 1));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_X, &PROP_FRAC_INT((s32) (2 * ctx->border + vis_w) - (s32) w, 2));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_Y, &PROP_FRAC_INT((s32) (2 * ctx->border + vis_h) - (s32) h, 2));
+	}
+	else
+	{
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_W, NULL);
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_H, NULL);
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_X, NULL);
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_Y, NULL);
+	}
+}
 
-		GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->ipid);
-		fevt.seek.start_offset = 0;
-		gf_filter_pid_send_event(ctx->ipid, &fevt);
-		return GF_TRUE;
-	case GF_FEVT_STOP:
-		ctx->is_playing = GF_FALSE;
-		return GF_FALSE;
-	default:
+/* Removes a frame from the scrub cache, with cache_mx held */
+static void QDBMP_cache_remove(GF_QDBMPCtx *ctx, QDBMPCachedFrame *frame)
+{
+	u32 i;
+
+	for ( i = 0; i < ctx->nb_frames; i++ )
+	{
+		if ( ctx->frames[ i ] != frame ) continue;
+		memmove( ctx->frames + i, ctx->frames + i + 1, ( ctx->nb_frames - i - 1 ) * sizeof( QDBMPCachedFrame * ) );
+		ctx->nb_frames--;
+		if ( !frame->evicted ) ctx->cache_bytes -= frame->size;
 		break;
 	}
-	//cancel all events
-	return GF_TRUE;
 }
 
-static const GF_FilterCapability QDBMPFullCaps[] =
-	{
-		CAP_UINT(GF_CAPS_INPUT, GF_PROP_PID_STREAM_TYPE, GF_STREAM_FILE),
-		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_FILE_EXT, "bmp"),
-		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_MIME, "image/bmp"),
-		CAP_UINT(GF_CAPS_OUTPUT, GF_PROP_PID_STREAM_TYPE, GF_STREAM_VISUAL),
-		CAP_UINT(GF_CAPS_OUTPUT, GF_PROP_PID_CODECID, GF_CODECID_RAW),
-};
+static void QDBMP_cache_free(QDBMPCachedFrame *frame)
+{
+	gf_free( frame->data );
+	gf_free( frame );
+}
 
-/**************************************************************
-	Reads the specified BMP image file.
-**************************************************************/
-static GF_Err QDBMP_process(GF_Filter *filter)
+/* A packet showing a cached frame is released, evicted frames are freed with their last packet */
+static void QDBMP_cache_release(GF_Filter *filter, GF_FilterPid *pid, GF_FilterPacket *pck)
 {
 	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
-	GF_FilterPacket *pck, *dst_pck;
-	u8 *data, *output;
-	u32 i, j, size;
-	BMP*	bmp;
-	u32 palettesize;
+	QDBMPCachedFrame *frame;
+	const u8 *data;
+	u32 i, size;
 
-	pck = gf_filter_pid_get_packet(ctx->ipid);
-	if (!pck)
+	data = gf_filter_pck_get_data( pck, &size );
+	gf_mx_p( ctx->cache_mx );
+	for ( i = 0; i < ctx->nb_frames; i++ )
 	{
-		if (gf_filter_pid_is_eos(ctx->ipid))
+		frame = ctx->frames[ i ];
+		if ( frame->data != data ) continue;
+		if ( frame->refs ) frame->refs--;
+		if ( !frame->refs && ( frame->evicted || !frame->ready ) )
 		{
-			if (ctx->opid)
-				gf_filter_pid_set_eos(ctx->opid);
-			return GF_EOS;
+			QDBMP_cache_remove( ctx, frame );
+			QDBMP_cache_free( frame );
 		}
-		return GF_OK;
+		break;
 	}
-	data = (unsigned char *)gf_filter_pck_get_data(pck, &size);
+	gf_mx_v( ctx->cache_mx );
+}
+
+/**************************************************************
+	Allocates an output packet of size bytes. With the scrub
+	cache, the frame is decoded straight into a cache buffer
+	shared with the packet, and is pending until
+	QDBMP_cache_insert.
+**************************************************************/
+static GF_FilterPacket *QDBMP_new_packet(GF_QDBMPCtx *ctx, u32 size, u8 **output)
+{
+	QDBMPCachedFrame *frame, **frames;
+	GF_FilterPacket *pck;
 
-	/* Allocate */
-	bmp = (BMP*)gf_malloc(sizeof( BMP ) );
-	if (bmp == NULL)
+	if ( !ctx->cache )
+		return gf_filter_pck_new_alloc(ctx->opid, size, output);
+
+	GF_SAFEALLOC( frame, QDBMPCachedFrame );
+	if ( !frame ) return NULL;
+	frame->data = gf_malloc( size ? size : 1 );
+	if ( !frame->data )
 	{
-		return GF_OUT_OF_MEM;
+		gf_free( frame );
+		return NULL;
 	}
+	frame->size = size;
+	frame->refs = 1;
 
-	FILE* f = fmemopen(data, size,"rb");
+	gf_mx_p( ctx->cache_mx );
+	frames = gf_realloc( ctx->frames, ( ctx->nb_frames + 1 ) * sizeof( QDBMPCachedFrame * ) );
+	if ( frames )
+	{
+		ctx->frames = frames;
+		ctx->frames[ ctx->nb_frames++ ] = frame;
+		ctx->cache_bytes += size;
+	}
+	gf_mx_v( ctx->cache_mx );
+	if ( !frames )
+	{
+		QDBMP_cache_free( frame );
+		return NULL;
+	}
 
-	if ( ReadHeader( bmp, f ) != BMP_OK || bmp->Header.Magic != 0x4D42 )
+	pck = gf_filter_pck_new_shared(ctx->opid, frame->data, size, QDBMP_cache_release);
+	if ( !pck )
 	{
-		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
-		fclose( f );
-		gf_free( bmp );
-		return GF_CORRUPTED_DATA;
+		gf_mx_p( ctx->cache_mx );
+		QDBMP_cache_remove( ctx, frame );
+		gf_mx_v( ctx->cache_mx );
+		QDBMP_cache_free( frame );
+		return NULL;
 	}
+	ctx->pending = frame;
+	*output = frame->data;
+	return pck;
+}
 
-	if ( bmp->Header.BitsPerPixel == 8 ) palettesize = BMP_PALETTE_SIZE_8bpp;
-	if ( bmp->Header.BitsPerPixel == 4 ) palettesize = BMP_PALETTE_SIZE_4bpp;
+/* Discards a packet from QDBMP_new_packet on decode errors */
+static void QDBMP_discard_packet(GF_QDBMPCtx *ctx, GF_FilterPacket *pck)
+{
+	QDBMPCachedFrame *frame = ctx->pending;
 
-	/* Verify that the bitmap variant is supported */
-	if ( ( bmp->Header.BitsPerPixel != 32 && bmp->Header.BitsPerPixel != 24
-		&& bmp->Header.BitsPerPixel != 8 && bmp->Header.BitsPerPixel != 4 )
-		|| bmp->Header.CompressionType != 0 || bmp->Header.HeaderSize != 40 )
+	/* The pending frame leaves the cache first, so the release callback cannot free it */
+	if ( frame )
 	{
-		BMP_LAST_ERROR_CODE = BMP_FILE_NOT_SUPPORTED;
-		fclose( f );
-		gf_free( bmp );
-		return GF_NOT_SUPPORTED;
+		gf_mx_p( ctx->cache_mx );
+		QDBMP_cache_remove( ctx, frame );
+		gf_mx_v( ctx->cache_mx );
+		ctx->pending = NULL;
+	}
+	gf_filter_pck_discard( pck );
+	if ( frame )
+		QDBMP_cache_free( frame );
+}
+
+/**************************************************************
+	Returns the ready frame with timestamp cts, or with covering
+	set, the frame shown at cts. Must be called with cache_mx
+	held.
+**************************************************************/
+static QDBMPCachedFrame *QDBMP_cache_find(GF_QDBMPCtx *ctx, u64 cts, Bool covering)
+{
+	u32 i;
+
+	for ( i = 0; i < ctx->nb_frames; i++ )
+	{
+		QDBMPCachedFrame *frame = ctx->frames[ i ];
+		if ( !frame->ready || frame->evicted ) continue;
+		if ( frame->cts == cts || ( covering && frame->cts < cts && cts < frame->cts + frame->dur ) )
+			return frame;
 	}
+	return NULL;
+}
+
+/**************************************************************
+	Evicts the frames farthest from the playhead until the cache
+	fits its budget. Frames behind the scrub direction count
+	double, so the window leans ahead. Must be called with
+	cache_mx held.
+**************************************************************/
+static void QDBMP_cache_evict(GF_QDBMPCtx *ctx)
+{
+	QDBMPCachedFrame *frame;
+	u64 dist, best_dist;
+	u32 i, best;
+	Bool behind;
 
-	/* Allocate and read palette */
-	if ( palettesize > 0 )
+	while ( ctx->cache_bytes > ctx->cache )
 	{
-		bmp->Palette = (UCHAR*) malloc( palettesize * sizeof( UCHAR ) );
-		if ( bmp->Palette == NULL )
+		best = ctx->nb_frames;
+		best_dist = 0;
+		for ( i = 0; i < ctx->nb_frames; i++ )
 		{
-			BMP_LAST_ERROR_CODE = BMP_OUT_OF_MEMORY;
-			fclose( f );
-			gf_free( bmp );
-			return GF_OUT_OF_MEM;
+			frame = ctx->frames[ i ];
+			if ( !frame->ready || frame->evicted || frame->cts == ctx->playhead ) continue;
+			if ( frame->cts > ctx->playhead )
+			{
+				dist = frame->cts - ctx->playhead;
+				behind = ctx->scrub_back;
+			}
+			else
+			{
+				dist = ctx->playhead - frame->cts;
+				behind = !ctx->scrub_back;
+			}
+			if ( behind ) dist *= 2;
+			if ( best == ctx->nb_frames || dist > best_dist )
+			{
+				best = i;
+				best_dist = dist;
+			}
 		}
+		if ( best == ctx->nb_frames )
+			break;
 
-		if ( fread( bmp->Palette, sizeof( UCHAR ), palettesize, f ) != palettesize )
+		frame = ctx->frames[ best ];
+		ctx->cache_bytes -= frame->size;
+		frame->evicted = GF_TRUE;
+		if ( !frame->refs )
 		{
-			BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
-			fclose( f );
-			gf_free( bmp->Palette );
-			gf_free( bmp );
-			return GF_CORRUPTED_DATA;
+			QDBMP_cache_remove( ctx, frame );
+			QDBMP_cache_free( frame );
 		}
 	}
-	else	/* Not an indexed image */
+}
+
+/**************************************************************
+	Stores the pending frame, decoded from an input packet with
+	timestamp cts, in the scrub cache.
+**************************************************************/
+static void QDBMP_cache_insert(GF_QDBMPCtx *ctx, u32 size, u64 cts, u32 dur, u32 codecid, u32 pixfmt, u32 w, u32 h, u32 stride, u32 vis_w, u32 vis_h)
+{
+	QDBMPCachedFrame *frame = ctx->pending, *old;
+
+	ctx->pending = NULL;
+	if ( !frame ) return;
+
+	gf_mx_p( ctx->cache_mx );
+	/* Encoded frames are smaller than their buffer */
+	ctx->cache_bytes -= frame->size - size;
+	frame->size = size;
+	frame->cts = cts;
+	frame->dur = dur;
+	frame->codecid = codecid;
+	frame->pixfmt = pixfmt;
+	frame->width = w;
+	frame->height = h;
+	frame->stride = stride;
+	frame->vis_w = vis_w;
+	frame->vis_h = vis_h;
+	frame->next_offset = ctx->input_offset;
+	frame->nb_colors = ctx->palette_size;
+	memcpy( frame->palette, ctx->colors.colors, frame->nb_colors * 4 );
+	frame->ready = GF_TRUE;
+
+	old = QDBMP_cache_find( ctx, cts, GF_FALSE );
+	if ( old && old != frame )
 	{
-		bmp->Palette = NULL;
+		ctx->cache_bytes -= old->size;
+		old->evicted = GF_TRUE;
+		if ( !old->refs )
+		{
+			QDBMP_cache_remove( ctx, old );
+			QDBMP_cache_free( old );
+		}
 	}
 
-	dst_pck = gf_filter_pck_new_alloc(ctx->opid,  BMP_GetWidth(bmp)*BMP_GetHeight(bmp)*4, &output);
+	/* Frames without timestamps cannot be looked up, they only live as long as their packet */
+	if ( cts == GF_FILTER_NO_TS )
+	{
+		ctx->cache_bytes -= frame->size;
+		frame->evicted = GF_TRUE;
+	}
+	else
+	{
+		ctx->last_size = size;
+		ctx->last_dur = dur;
+	}
+	QDBMP_cache_evict( ctx );
+	gf_mx_v( ctx->cache_mx );
+}
 
-	switch (BMP_GetDepth(bmp)){
-		case 32:
-		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( GF_PIXEL_RGBX ));
-		fread( output, sizeof( UCHAR ), BMP_GetWidth(bmp)*BMP_GetHeight(bmp)*4, f );
-		break;
+/**************************************************************
+	Keeps a frame decoded ahead of the playhead in the scrub
+	cache, and discards its packet.
+**************************************************************/
+static void QDBMP_cache_keep(GF_QDBMPCtx *ctx, QDBMPCachedFrame *frame, GF_FilterPacket *pck)
+{
+	/* The release callback may run on discard, the extra reference keeps the frame until then */
+	gf_mx_p( ctx->cache_mx );
+	frame->refs++;
+	gf_mx_v( ctx->cache_mx );
 
-		case 24:
-		return GF_NOT_SUPPORTED; //TODO
-		{
-			int stride = bmp->Header.Width;
-			if (bmp->Header.Width % 4 != 0)
-				stride = bmp->Header.Width + (4 - (bmp->Header.Width % 4)); // typically 4-byte aligned
-			int diff = bmp->Header.FileSize - (stride * bmp->Header.Height * 3) - palettesize;
-			if (diff > 4 || diff < 0)
-			{
-				printf("error in stride\n");
-				return GF_CORRUPTED_DATA;
-			} // need to handcheck if not aligned
-		}
+	gf_filter_pck_discard( pck );
 
-		break;
+	gf_mx_p( ctx->cache_mx );
+	frame->refs = 0;
+	if ( frame->evicted )
+	{
+		QDBMP_cache_remove( ctx, frame );
+		QDBMP_cache_free( frame );
+	}
+	gf_mx_v( ctx->cache_mx );
+}
 
-		case 8:
-		return GF_NOT_SUPPORTED; //TODO
-		break;
+/**************************************************************
+	Sends a cached frame by reference. Its timing is copied from
+	the input packet pck if any, or else set from the cache.
+**************************************************************/
+static GF_Err QDBMP_cache_send(GF_QDBMPCtx *ctx, QDBMPCachedFrame *frame, GF_FilterPacket *pck)
+{
+	GF_FilterPacket *dst_pck;
+
+	/* Found frames are ready and only evicted from the process thread, the reference keeps them */
+	gf_mx_p( ctx->cache_mx );
+	frame->refs++;
+	gf_mx_v( ctx->cache_mx );
+
+	dst_pck = gf_filter_pck_new_shared(ctx->opid, frame->data, frame->size, QDBMP_cache_release);
+	if ( !dst_pck )
+	{
+		gf_mx_p( ctx->cache_mx );
+		frame->refs--;
+		gf_mx_v( ctx->cache_mx );
+		return GF_OUT_OF_MEM;
 	}
-	/* Allocate memory for image data */
-	//dst_pck = gf_filter_pck_new_alloc(ctx->opid,  BMP_GetWidth(bmp)*BMP_GetHeight(bmp)*4, &output);
 
-	//fread( output, sizeof( UCHAR ), bmp->Header.ImageDataSize, f ); // FIXME : size is not matching
-	/*if ( fread( output, sizeof( UCHAR ), bmp->Header.ImageDataSize, f ) != bmp->Header.ImageDataSize )
+	QDBMP_set_frame_props( ctx, frame->codecid, frame->pixfmt, frame->width, frame->height, frame->stride, frame->vis_w, frame->vis_h, frame->palette, frame->nb_colors );
+	if ( pck )
 	{
-		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
-		fclose( f );
-		gf_free( bmp->Data );
-		gf_free( bmp->Palette );
-		gf_free( bmp );
-		return GF_CORRUPTED_DATA;
-	}*/
+		gf_filter_pck_merge_properties( pck, dst_pck );
+	}
+	else
+	{
+		gf_filter_pck_set_cts( dst_pck, frame->cts );
+		gf_filter_pck_set_duration( dst_pck, frame->dur );
+		gf_filter_pck_set_sap( dst_pck, GF_FILTER_SAP_1 );
+	}
+	gf_filter_pck_set_dependency_flags( dst_pck, 0 );
+	ctx->playhead = frame->cts;
+	return gf_filter_pck_send( dst_pck );
+}
 
-	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_WIDTH, &PROP_UINT(BMP_GetWidth(bmp)));
-	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_HEIGHT, &PROP_UINT(BMP_GetHeight(bmp)));
-	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STRIDE, &PROP_UINT(4 * BMP_GetWidth(bmp)));
+/* Seeks the source to a byte offset, from the start if unknown; queued packets are from before the seek */
+static void QDBMP_seek_source(GF_QDBMPCtx *ctx, u64 offset)
+{
+	GF_FilterEvent fevt;
 
-	fclose( f );
-	gf_free( bmp->Palette );
-	gf_free( bmp );
+	GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->ipid);
+	fevt.seek.start_offset = ( offset != GF_FILTER_NO_BO ) ? offset : 0;
+	gf_filter_pid_send_event(ctx->ipid, &fevt);
+}
 
-	gf_filter_pck_merge_properties(pck, dst_pck);
-	gf_filter_pck_set_dependency_flags(dst_pck, 0);
-	gf_filter_pck_send(dst_pck);
-	gf_filter_pid_drop_packet(ctx->ipid);
+/**************************************************************
+	Starts serving cached frames from frame. The source is
+	seeked right away to prefetch in the direction of travel
+	while the cached run is served: the frames following the
+	run when scrubbing forward, the decode_from window before
+	the target, read from the start, when scrubbing backward.
+**************************************************************/
+static void QDBMP_cache_prefetch(GF_Filter *filter, GF_QDBMPCtx *ctx, QDBMPCachedFrame *frame)
+{
+	QDBMPCachedFrame *next;
+	u64 run_end, run_offset;
+
+	ctx->prefetch = GF_FALSE;
+	ctx->serve_offset = GF_FILTER_NO_BO;
+	/* Byte-range frames are fetched a region at a time once serving ends */
+	if ( ctx->ranged )
+		return;
+
+	/* End of the contiguous cached run */
+	gf_mx_p( ctx->cache_mx );
+	while ( frame->dur && ( next = QDBMP_cache_find( ctx, frame->cts + frame->dur, GF_FALSE ) ) != NULL )
+		frame = next;
+	run_end = frame->cts + frame->dur;
+	run_offset = frame->next_offset;
+	gf_mx_v( ctx->cache_mx );
+
+	/* Prefetched frames are only cached until serving ends */
+	ctx->prefetch = GF_TRUE;
+	ctx->play_from = (u64) -1;
+	if ( ctx->scrub_back )
+		ctx->source_cts = 0;
+	else
+		ctx->decode_from = ctx->source_cts = run_end;
+
+	if ( ctx->archive )
+	{
+		QDBMP_seek_archive( filter, ctx, ctx->decode_from );
+		return;
+	}
+	while ( gf_filter_pid_get_packet( ctx->ipid ) )
+		gf_filter_pid_drop_packet( ctx->ipid );
+	QDBMP_seek_source( ctx, ctx->scrub_back ? 0 : run_offset );
+}
+
+/**************************************************************
+	Positions the scrub cache on a seek to start seconds. Returns
+	GF_TRUE if the frame shown at start is cached and will be
+	served from the cache, in which case the source prefetches
+	meanwhile.
+**************************************************************/
+static Bool QDBMP_cache_seek(GF_Filter *filter, GF_QDBMPCtx *ctx, Double start)
+{
+	QDBMPCachedFrame *frame;
+	u64 target, span;
+
+	ctx->serving = GF_FALSE;
+	if ( !ctx->timescale )
+		return GF_FALSE;
+
+	target = ( start > 0 ) ? (u64) ( start * ctx->timescale ) : 0;
+	ctx->scrub_back = ( target < ctx->playhead ) ? GF_TRUE : GF_FALSE;
+	ctx->decode_from = ctx->play_from = target;
+
+	/* Scrubbing backward, the frames before the target are decoded ahead into half of the cache */
+	if ( ctx->scrub_back && ctx->last_size && ctx->last_dur )
+	{
+		span = (u64) ( ctx->cache / 2 / ctx->last_size ) * ctx->last_dur;
+		ctx->decode_from = ( target > span ) ? target - span : 0;
+	}
+
+	gf_mx_p( ctx->cache_mx );
+	frame = QDBMP_cache_find( ctx, target, GF_TRUE );
+	gf_mx_v( ctx->cache_mx );
+	if ( !frame )
+		return GF_FALSE;
+
+	ctx->serving = GF_TRUE;
+	ctx->serve_cts = frame->cts;
+	QDBMP_cache_prefetch( filter, ctx, frame );
+	gf_filter_post_process_task(filter);
+	return GF_TRUE;
+}
+
+/**************************************************************
+	Serves the cached frames following a seek, one per call, as
+	long as they are contiguous. Playback then continues from
+	the prefetching source if it has not passed the next frame,
+	or else the source is seeked to resume after the last served
+	frame.
+**************************************************************/
+static GF_Err QDBMP_cache_serve(GF_Filter *filter, GF_QDBMPCtx *ctx)
+{
+	QDBMPCachedFrame *frame;
+	GF_Err e;
+
+	/* Without prefetch, queued input packets belong to the position before the seek, archives are seeked without reading */
+	while ( !ctx->prefetch && !ctx->archive && gf_filter_pid_get_packet( ctx->ipid ) )
+		gf_filter_pid_drop_packet( ctx->ipid );
+
+	gf_mx_p( ctx->cache_mx );
+	frame = QDBMP_cache_find( ctx, ctx->serve_cts, GF_FALSE );
+	gf_mx_v( ctx->cache_mx );
+	if ( frame )
+	{
+		e = QDBMP_cache_send( ctx, frame, NULL );
+		if ( e ) return e;
+		ctx->serve_cts = frame->cts + MAX( frame->dur, 1 );
+		ctx->serve_offset = frame->next_offset;
+		if ( frame->dur )
+		{
+			gf_filter_post_process_task(filter);
+			return GF_OK;
+		}
+	}
 
-	// dataInd = 0;
-	// /* Read header */
-	// if ((ReadHeader(data, size) != BMP_OK) || (bmp->Header.Magic != 0x4D42))
-	// {
-
-	// 	free(bmp);
-	// 	return GF_NOT_SUPPORTED;
-	// }
-
-	// /* Verify that the bitmap variant is supported */
-	// if ((bmp->Header.BitsPerPixel != 32 && bmp->Header.BitsPerPixel != 24 && bmp->Header.BitsPerPixel != 8) || bmp->Header.CompressionType != 0 || bmp->Header.HeaderSize != 40)
-	// {
-	// 	free(bmp);
-	// 	return GF_NOT_SUPPORTED;
-	// }
-
-	// /* Allocate and read palette */
-	// if (bmp->Header.BitsPerPixel == 8)
-	// {
-	// 	bmp->Palette = (UCHAR *)malloc(BMP_PALETTE_SIZE * sizeof(UCHAR));
-	// 	if (bmp->Palette == NULL)
-	// 	{
-	// 		free(bmp);
-	// 		return GF_OUT_OF_MEM;
-	// 	}
-
-	// 	if (dataInd + BMP_PALETTE_SIZE > size)
-	// 	{
-	// 		free(bmp->Palette);
-	// 		free(bmp);
-	// 		return GF_CORRUPTED_DATA;
-	// 	}
-	// 	else
-	// 	{
-	// 		memcpy(bmp->Palette, data + dataInd, BMP_PALETTE_SIZE);
-	// 		dataInd += BMP_PALETTE_SIZE;
-	// 	}
-	// }
-	// else /* Not an indexed image */
-	// {
-	// 	bmp->Palette = NULL;
-	// }
-
-	// pck_dst = gf_filter_pck_new_alloc(ctx->opid, bmp->Header.Width * bmp->Header.Height * bpp, &bmp->Data);
-	// if (!pck_dst)
-	// 	return GF_OUT_OF_MEM;
-
-	// /* Allocate memory for image data */
-	// /*bmp->Data = (UCHAR*) malloc( bmp->Header.ImageDataSize );*/
-	// // bmp->Data = (UCHAR*) malloc( bmp->Header.Width* bmp->Header.Height * 4); /* forcing RGBA output*/
-	// if (bmp->Data == NULL)
-	// {
-	// 	free(bmp->Palette);
-	// 	free(bmp);
-	// 	return GF_OUT_OF_MEM;
-	// }
-
-	// /* Read image data */
-	// if (dataInd + bmp->Header.ImageDataSize > size)
-	// {
-	// 	free(bmp->Data);
-	// 	free(bmp->Palette);
-	// 	free(bmp);
-	// 	return GF_CORRUPTED_DATA;
-	// }
-	// // TODO:
-	// //  handle encoded
-	// //  add in palette. currently 8bpp unmapped
-	// else
-	// {
-	// 	if (bmp->Header.BitsPerPixel == 32) // nothing much to do for this case; unless in BGR format
-	// 	{
-	// 		// FIXME : Image is upside down :(
-	// 		memcpy( bmp->Data, data+dataInd, bmp->Header.Width* bmp->Header.Height * bpp);
-	// 	}
-	// 	else if (bmp->Header.BitsPerPixel == 24)
-	// 	{ /* we need to insert that alpha; rather than memcpy RGB chunks, let's go one-by-one in case we need to debug  */
-	// 		int stride = bmp->Header.Width;
-	// 		if (bmp->Header.Width % 4 != 0)
-	// 			stride = bmp->Header.Width + (4 - (bmp->Header.Width % 4)); // typically 4-byte aligned
-	// 		int diff = bmp->Header.FileSize - (stride * bmp->Header.Height * 3) - dataInd;
-	// 		if (diff > 4 || diff < 0)
-	// 		{
-	// 			printf("error in stride\n");
-	// 			return GF_CORRUPTED_DATA;
-	// 		} // need to handcheck if not aligned
-
-	// 		UCHAR *tmp = bmp->Data;
-
-	// 		// for (i=0; i<bmp->Header.Height; ++i) // if flipped vertically
-	// 		for (i = (bmp->Header.Height) - 1; i > -1; --i)
-	// 		{
-	// 			for (j = 0; j < bmp->Header.Width * 3; j = j + 3)
-	// 			{
-	// 				// typically stored in BGR so switch to RGB
-	// 				if (i < 987)
-	// 				{
-	// 					unsigned char *ctmp;
-	// 					*ctmp = *(data + dataInd + i * stride * 3 + j);
-	// 				}
-	// 				*(tmp) = *(data + dataInd + i * stride * 3 + j + 2);
-	// 				++tmp;
-	// 				*(tmp) = *(data + dataInd + i * stride * 3 + j + 1);
-	// 				++tmp;
-	// 				*(tmp) = *(data + dataInd + i * stride * 3 + j);
-	// 				++tmp;
-	// 				*(tmp) = 255;
-	// 				++tmp;
-	// 			}
-	// 		}
-	// 	}
-	// 	else if (bmp->Header.BitsPerPixel == 8)
-	// 	{ /* we need to expand to RGB and insert the alpha  */
-	// 		UCHAR *tmp = bmp->Data;
-	// 		for (i = 0; i < bmp->Header.Height * bmp->Header.Width; ++i)
-	// 		{
-	// 			*(tmp) = *(data + dataInd + i);
-	// 			++tmp;
-	// 			*(tmp) = *(data + dataInd + i);
-	// 			++tmp;
-	// 			*(tmp) = *(data + dataInd + i);
-	// 			++tmp;
-	// 			*(tmp) = 255;
-	// 			++tmp;
-	// 		}
-	// 	}
-	// }
-	// // pass on back
-	// // Keeping the width/height etc as funcs rahter than just accessing the structure, in case we move this
-	// // code elsewhere
-	// gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_WIDTH, &PROP_UINT(BMP_GetWidth()));
-	// gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_HEIGHT, &PROP_UINT(BMP_GetHeight()));
-
-	// // Only doing RGBA output at the moment
-	// gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, &PROP_UINT(GF_PIXEL_RGBX));
-	// gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STRIDE, &PROP_UINT(bpp * BMP_GetWidth()));
-
-	// gf_filter_pck_merge_properties(pck, pck_dst);
-	// gf_filter_pck_set_dependency_flags(pck_dst, 0);
-	// gf_filter_pck_send(pck_dst);
-	// gf_filter_pid_drop_packet(ctx->ipid);
-
-	// // TODO: free the local data
-	// free(bmp);
+	ctx->serving = GF_FALSE;
+	ctx->play_from = ctx->serve_cts;
+	/* The prefetching source delivers the next frame in turn */
+	if ( ctx->prefetch && ctx->source_cts <= ctx->serve_cts )
+		return GF_OK;
 
+	ctx->prefetch = GF_FALSE;
+	ctx->decode_from = ctx->serve_cts;
+	if ( ctx->archive )
+	{
+		QDBMP_seek_archive( filter, ctx, ctx->serve_cts );
+		return GF_OK;
+	}
+	if ( ctx->ranged )
+	{
+		QDBMP_range_restart( ctx );
+		return GF_OK;
+	}
+	while ( gf_filter_pid_get_packet( ctx->ipid ) )
+		gf_filter_pid_drop_packet( ctx->ipid );
+	QDBMP_seek_source( ctx, ctx->serve_offset );
 	return GF_OK;
 }
 
+static Bool QDBMP_process_event(GF_Filter *filter, const GF_FilterEvent *evt)
+{
+	GF_FilterEvent fevt;
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+	if (evt->base.on_pid != ctx->opid) return GF_TRUE;
+	switch (evt->base.type) {
+	case GF_FEVT_PLAY:
+		if (ctx->is_playing) {
+			return GF_TRUE;
+		}
+
+		ctx->is_playing = GF_TRUE;
+		if (!ctx->initial_play_done) {
+			ctx->initial_play_done = GF_TRUE;
+			return GF_TRUE;
+		}
+
+		if ( ctx->cache && QDBMP_cache_seek( filter, ctx, evt->play.start_range ) )
+			return GF_TRUE;
+
+		if ( ctx->archive )
+		{
+			QDBMP_seek_archive( filter, ctx, ctx->cache ? ctx->decode_from : (u64) ( MAX( evt->play.start_range, 0 ) * ctx->fps.num ) );
+			return GF_TRUE;
+		}
+
+		if ( ctx->mosaic )
+		{
+			u32 i;
+			for ( i = 0; i < ctx->nb_cells; i++ )
+			{
+				if ( !ctx->cells[ i ] ) continue;
+				GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->cells[ i ]);
+				fevt.seek.start_offset = 0;
+				gf_filter_pid_send_event(ctx->cells[ i ], &fevt);
+			}
+			return GF_TRUE;
+		}
+
+		if ( ctx->ranged )
+		{
+			QDBMP_range_restart( ctx );
+			return GF_TRUE;
+		}
+
+		GF_FEVT_INIT(fevt, GF_FEVT_SOURCE_SEEK, ctx->ipid);
+		fevt.seek.start_offset = 0;
+		gf_filter_pid_send_event(ctx->ipid, &fevt);
+		return GF_TRUE;
+	case GF_FEVT_STOP:
+		ctx->is_playing = GF_FALSE;
+		return GF_FALSE;
+	default:
+		break;
+	}
+	//cancel all events
+	return GF_TRUE;
+}
+
+static const GF_FilterCapability QDBMPFullCaps[] =
+	{
+		CAP_UINT(GF_CAPS_INPUT, GF_PROP_PID_STREAM_TYPE, GF_STREAM_FILE),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_FILE_EXT, "bmp"),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_FILE_EXT, "qoi"),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_FILE_EXT, "tar"),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_MIME, "image/bmp"),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_MIME, "image/qoi"),
+		CAP_STRING(GF_CAPS_INPUT, GF_PROP_PID_MIME, "application/x-tar"),
+		CAP_UINT(GF_CAPS_OUTPUT, GF_PROP_PID_STREAM_TYPE, GF_STREAM_VISUAL),
+		CAP_UINT(GF_CAPS_OUTPUT, GF_PROP_PID_CODECID, GF_CODECID_RAW),
+		CAP_UINT(GF_CAPS_OUTPUT, GF_PROP_PID_CODECID, QDBMP_CODECID_QOI),
+};
+
+/* Maps the QDBMP error codes of the shared parsing code */
+static GF_Err QDBMP_error(BMP_STATUS status)
+{
+	switch ( status )
+	{
+	case BMP_OK:					return GF_OK;
+	case BMP_OUT_OF_MEMORY:			return GF_OUT_OF_MEM;
+	case BMP_FILE_NOT_SUPPORTED:	return GF_NOT_SUPPORTED;
+	case BMP_INVALID_ARGUMENT:		return GF_BAD_PARAM;
+	default:						return GF_CORRUPTED_DATA;
+	}
+}
+
+/* Tiling applies to raw color and greyscale frames */
+static Bool QDBMP_is_tiled(GF_QDBMPCtx *ctx, Bool grey)
+{
+	return ( ctx->tile && !ctx->bin && ( grey || !ctx->qoi ) ) ? GF_TRUE : GF_FALSE;
+}
+
+/**************************************************************
+	Computes the output frame geometry for the current options.
+	Returns the frame size in bytes, which may not fit the 32 bit
+	packet allocator.
+**************************************************************/
+static u64 QDBMP_output_size(GF_QDBMPCtx *ctx, const QDBMPSource *src, Bool grey, u32 *out_w, u32 *out_h, u32 *out_stride)
+{
+	u64 w = src->width, h = src->height, stride;
+
+	if ( ctx->bin )
+	{
+		stride = ( w + 7 ) / 8;
+	}
+	else
+	{
+		if ( ctx->padw > 1 ) w = ( ( w + ctx->padw - 1 ) / ctx->padw ) * ctx->padw;
+		if ( ctx->padh > 1 ) h = ( ( h + ctx->padh - 1 ) / ctx->padh ) * ctx->padh;
+		w += 2 * (u64) ctx->border;
+		h += 2 * (u64) ctx->border;
+		/* Tiled frames are padded to whole tiles */
+		if ( QDBMP_is_tiled( ctx, grey ) )
+		{
+			w = ( ( w + ctx->tile - 1 ) / ctx->tile ) * ctx->tile;
+			h = ( ( h + ctx->tile - 1 ) / ctx->tile ) * ctx->tile;
+		}
+		stride = w * ( grey ? 1 : 4 );
+	}
+
+	*out_w = (u32) w;
+	*out_h = (u32) h;
+	*out_stride = (u32) stride;
+	if ( h > 0xFFFFFFFF || stride > 0xFFFFFFFF )
+		return (u64) -1;
+
+	/* QOI needs at most 4 bytes per opaque pixel */
+	if ( ctx->qoi && !grey && !ctx->bin )
+		return stride * h + QOI_HEADER_SIZE + QOI_END_SIZE;
+	return stride * h;
+}
+
+/* Error of frames rejected by a configured resource limit, telling them from decoding failures */
+#define QDBMP_LIMIT_ERR	GF_NOT_SUPPORTED
+
+/**************************************************************
+	Checks a frame against the resource limits, from its header
+	only. Rejections are counted and logged, and return
+	QDBMP_LIMIT_ERR.
+**************************************************************/
+static GF_Err QDBMP_check_limits(GF_QDBMPCtx *ctx, const QDBMPSource *src, u64 out_size, u32 in_size)
+{
+	const char *limit;
+
+	if ( ctx->maxpix && (u64) src->width * src->height > ctx->maxpix )
+	{
+		ctx->nb_rej_pix++;
+		limit = "pixel count";
+	}
+	else if ( out_size > 0xFFFFFFFF || ( ctx->maxbytes && out_size > ctx->maxbytes ) )
+	{
+		ctx->nb_rej_bytes++;
+		limit = "output size";
+	}
+	else if ( ctx->maxratio > 0 && (Double) out_size > ctx->maxratio * in_size )
+	{
+		ctx->nb_rej_ratio++;
+		limit = "expansion ratio";
+	}
+	else
+	{
+		return GF_OK;
+	}
+
+	GF_LOG(GF_LOG_WARNING, GF_LOG_CODEC, ("[QDBMP] Rejecting %ux%u frame (%u bytes in, "LLU" bytes out): %s limit exceeded\n", src->width, src->height, in_size, out_size, limit));
+	return QDBMP_LIMIT_ERR;
+}
+
+/**************************************************************
+	Returns GF_TRUE once the current frame has been decoding for
+	longer than maxtime. The rejection is counted and logged, the
+	caller aborts the frame with QDBMP_LIMIT_ERR.
+**************************************************************/
+static Bool QDBMP_timed_out(GF_QDBMPCtx *ctx)
+{
+	if ( !ctx->maxtime || gf_sys_clock_high_res() - ctx->frame_start <= (u64) ctx->maxtime * 1000 )
+		return GF_FALSE;
+
+	ctx->nb_rej_time++;
+	GF_LOG(GF_LOG_WARNING, GF_LOG_CODEC, ("[QDBMP] Aborting frame: decode time limit of %u ms exceeded\n", ctx->maxtime));
+	return GF_TRUE;
+}
+
+/* Number of rows decoded between two decode time checks */
+#define BMP_TIME_CHECK_ROWS	64
+
+/**************************************************************
+	Rewrites an RGBX plane of w x h pixels in place as palette
+	indices of the colors counted in ctx->colors, 4 BPP for up
+	to 16 colors, and shrinks its packet. Returns the stride of
+	the indexed plane.
+**************************************************************/
+static u32 QDBMP_index_plane(GF_QDBMPCtx *ctx, GF_FilterPacket *pck, u8 *output, u32 w, u32 h, u32 stride)
+{
+	u32 y, bits = ( ctx->colors.nb_colors <= 16 ) ? 4 : 8;
+	u32 out_stride = ( w * bits + 7 ) / 8;
+
+	/* Indexed rows are shorter, each lands at or before the RGBX row it is read from */
+	for ( y = 0; y < h; y++ )
+		IndexRow( output + y * out_stride, output + y * stride, w, &ctx->colors, bits );
+
+	gf_filter_pck_truncate( pck, out_stride * h );
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( ( bits == 4 ) ? QDBMP_PIXEL_PAL4 : QDBMP_PIXEL_PAL8 ));
+	ctx->palette_size = ctx->colors.nb_colors;
+	return out_stride;
+}
+
+/**************************************************************
+	Decodes the rows to an RGBX or greyscale plane of w x h
+	pixels, padded to the padw/padh alignment plus border pixels
+	on each side. Margins replicate the edge pixels as each row
+	is converted. With the indexed option, the colors of linear
+	RGBX planes are counted as the rows are converted, and planes
+	of at most 256 colors are indexed, updating the stride.
+**************************************************************/
+static GF_Err QDBMP_decode_plane(GF_QDBMPCtx *ctx, const QDBMPSource *src, Bool grey, u32 w, u32 h, u32 *out_stride, GF_FilterPacket **dst_pck)
+{
+	u8 *output, *row;
+	u32 i, y, stride = *out_stride;
+	u32 pixel_size = grey ? 1 : 4;
+	u32 right = w - ctx->border - src->width;
+	u32 bottom = h - ctx->border - src->height;
+	Bool tiled = QDBMP_is_tiled( ctx, grey );
+	/* Counting stops once the frame has more than 256 colors */
+	Bool count = ( ctx->indexed && !grey && !tiled ) ? GF_TRUE : GF_FALSE;
+
+	if ( count )
+		ColorTableReset( &ctx->colors );
+
+	/* Tiled frames are converted one row at a time into a row buffer, then stored into the tiles of their band */
+	if ( tiled && ctx->tile_row_size < stride )
+	{
+		u8 *buf = gf_realloc( ctx->tile_row, stride );
+		if ( !buf ) return GF_OUT_OF_MEM;
+		ctx->tile_row = buf;
+		ctx->tile_row_size = stride;
+	}
+
+	*dst_pck = QDBMP_new_packet(ctx, stride * h, &output);
+	if (!*dst_pck) return GF_OUT_OF_MEM;
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( grey ? GF_PIXEL_GREYSCALE : GF_PIXEL_RGBX ));
+
+	/* Linear frames convert the source rows in place, tiled frames convert every output row including the margins */
+	for ( y = 0; y < ( tiled ? h : src->height ); y++ )
+	{
+		if ( !( y % BMP_TIME_CHECK_ROWS ) && QDBMP_timed_out( ctx ) )
+		{
+			QDBMP_discard_packet( ctx, *dst_pck );
+			*dst_pck = NULL;
+			return QDBMP_LIMIT_ERR;
+		}
+
+		if ( tiled )
+		{
+			i = ( y > ctx->border ) ? MIN( y - ctx->border, src->height - 1 ) : 0;
+			row = ctx->tile_row;
+		}
+		else
+		{
+			i = y;
+			row = output + ( ctx->border + i ) * stride;
+		}
+		if ( grey )
+			GreyRow( row + ctx->border, BMP_SOURCE_ROW( src, i ), src->width, src->bpp, src->grey_lut, ctx->channel, ctx->grey );
+		else
+			ColorRow( row + ctx->border * 4, BMP_SOURCE_ROW( src, i ), src->width, src->bpp, src->color_lut );
+		if ( count )
+			count = CountColorsRow( &ctx->colors, row + ctx->border * 4, src->width );
+		if ( w != src->width )
+			PadRow( row, src->width, ctx->border, right, pixel_size );
+		if ( tiled )
+			TileRow( output + (u64) ( y / ctx->tile ) * ctx->tile * stride, row, w, y % ctx->tile, ctx->tile, ctx->morton, pixel_size );
+	}
+	if ( tiled )
+		return GF_OK;
+
+	/* Top and bottom margins repeat the first and last rows */
+	row = output + ctx->border * stride;
+	for ( i = 0; i < ctx->border; i++ )
+		memcpy( output + i * stride, row, stride );
+	row = output + ( ctx->border + src->height - 1 ) * stride;
+	for ( i = 1; i <= bottom; i++ )
+		memcpy( row + i * stride, row, stride );
+
+	/* Margins only repeat counted colors */
+	if ( count )
+		*out_stride = QDBMP_index_plane( ctx, *dst_pck, output, w, h, stride );
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes the rows to RGBX and encodes them as a QOI image of
+	w x h pixels, one output row at a time. Padding follows the
+	same rules as QDBMP_decode_plane.
+**************************************************************/
+static GF_Err QDBMP_encode_qoi(GF_QDBMPCtx *ctx, const QDBMPSource *src, u32 w, u32 h, u32 stride, GF_FilterPacket **dst_pck)
+{
+	QOIState qoi;
+	u8 *output, *out, *row;
+	u32 y, sy, prev_sy = (u32) -1;
+	u32 right = w - ctx->border - src->width;
+
+	row = gf_malloc( stride );
+	if ( !row ) return GF_OUT_OF_MEM;
+
+	*dst_pck = QDBMP_new_packet(ctx, stride * h + QOI_HEADER_SIZE + QOI_END_SIZE, &output);
+	if (!*dst_pck)
+	{
+		gf_free( row );
+		return GF_OUT_OF_MEM;
+	}
+
+	out = QOIStart( &qoi, output, w, h, 3 );
+	for ( y = 0; y < h; y++ )
+	{
+		if ( !( y % BMP_TIME_CHECK_ROWS ) && QDBMP_timed_out( ctx ) )
+		{
+			gf_free( row );
+			QDBMP_discard_packet( ctx, *dst_pck );
+			*dst_pck = NULL;
+			return QDBMP_LIMIT_ERR;
+		}
+
+		/* Margin rows repeat the nearest visible row, which is still in the row buffer */
+		sy = ( y < ctx->border ) ? 0 : MIN( y - ctx->border, src->height - 1 );
+		if ( sy != prev_sy )
+		{
+			ColorRow( row + ctx->border * 4, BMP_SOURCE_ROW( src, sy ), src->width, src->bpp, src->color_lut );
+			if ( w != src->width )
+				PadRow( row, src->width, ctx->border, right, 4 );
+			prev_sy = sy;
+		}
+		out = QOIEncodeRow( &qoi, out, row, w );
+	}
+	out = QOIFinish( &qoi, out );
+
+	gf_free( row );
+	gf_filter_pck_truncate( *dst_pck, (u32) ( out - output ) );
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes a QOI image, as produced with the qoi option, to an
+	RGBX or RGBA frame. Frames of a tar member m are sent at cts.
+**************************************************************/
+static GF_Err QDBMP_process_qoi(GF_QDBMPCtx *ctx, GF_FilterPacket *pck, const TarMember *m, const u8 *data, u32 size, u64 cts)
+{
+	GF_FilterPacket *dst_pck;
+	QDBMPSource src;
+	QOIState qoi;
+	u8 *output;
+	u8 channels;
+	u32 y;
+	GF_Err e;
+
+	memset( &src, 0, sizeof( src ) );
+	src.width = (u32) data[ 4 ] << 24 | data[ 5 ] << 16 | data[ 6 ] << 8 | data[ 7 ];
+	src.height = (u32) data[ 8 ] << 24 | data[ 9 ] << 16 | data[ 10 ] << 8 | data[ 11 ];
+	channels = data[ 12 ];
+	if ( !src.width || !src.height || ( channels != 3 && channels != 4 ) )
+		return GF_CORRUPTED_DATA;
+
+	e = QDBMP_check_limits( ctx, &src, (u64) src.width * src.height * 4, size );
+	if ( e )
+		return e;
+
+	dst_pck = gf_filter_pck_new_alloc(ctx->opid, src.width * src.height * 4, &output);
+	if ( !dst_pck )
+		return GF_OUT_OF_MEM;
+	QOIDecodeStart( &qoi );
+	for ( y = 0; y < src.height; y++, output += 4 * src.width )
+	{
+		if ( !( y % BMP_TIME_CHECK_ROWS ) && QDBMP_timed_out( ctx ) )
+		{
+			gf_filter_pck_discard( dst_pck );
+			return QDBMP_LIMIT_ERR;
+		}
+		if ( !QOIDecodeRow( &qoi, output, src.width, data, size ) )
+		{
+			gf_filter_pck_discard( dst_pck );
+			return GF_CORRUPTED_DATA;
+		}
+	}
+
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CODECID, &PROP_UINT(GF_CODECID_RAW));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( ( channels == 4 ) ? GF_PIXEL_RGBA : GF_PIXEL_RGBX ));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_WIDTH, &PROP_UINT(src.width));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_HEIGHT, &PROP_UINT(src.height));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STRIDE, &PROP_UINT(4 * src.width));
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_W, NULL);
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_H, NULL);
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_X, NULL);
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_CLAP_Y, NULL);
+	gf_filter_pid_set_property(ctx->opid, QDBMP_PROP_PALETTE, NULL);
+
+	gf_filter_pck_merge_properties(pck, dst_pck);
+	if ( m )
+		QDBMP_set_member_props( ctx, dst_pck, m, cts );
+	gf_filter_pck_set_dependency_flags(dst_pck, 0);
+	gf_filter_pck_send(dst_pck);
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes the rows to a packed 1 BPP plane. Rows are converted
+	to greyscale one band of tiles at a time, accumulating the
+	tile histograms on the way, then thresholded and packed.
+	1 BPP images are only flipped.
+**************************************************************/
+static GF_Err QDBMP_binarize(GF_QDBMPCtx *ctx, const QDBMPSource *src, u32 stride, GF_FilterPacket **dst_pck)
+{
+	u32 width = src->width, height = src->height;
+	u8 *output, *band;
+	u32 *hist = NULL, *thresh;
+	u32 i, j, y, rows, band_h, tile_w, nb_tiles;
+
+	*dst_pck = QDBMP_new_packet(ctx, stride * height, &output);
+	if (!*dst_pck) return GF_OUT_OF_MEM;
+	gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_PIXFMT, & PROP_UINT( QDBMP_PIXEL_MONO ));
+
+	if ( src->bpp == 1 )
+	{
+		/* Palette order decides which bit value is white */
+		u8 invert = ( src->grey_lut[ 0 ] > src->grey_lut[ 1 ] ) ? 0xFF : 0x00;
+		u8 last_mask = ( width & 7 ) ? (u8) ( 0xFF << ( 8 - ( width & 7 ) ) ) : 0xFF;
+
+		for ( i = 0; i < height; i++ )
+		{
+			u8 *dst = output + i * stride;
+			const u8 *row = BMP_SOURCE_ROW( src, i );
+			for ( j = 0; j < stride; j++ )
+				dst[ j ] = row[ j ] ^ invert;
+			dst[ stride - 1 ] &= last_mask;
+		}
+		return GF_OK;
+	}
+
+	if ( ctx->bin == BMP_BIN_OTSU && ctx->bintile )
+	{
+		band_h = MIN( ctx->bintile, height );
+		tile_w = ctx->bintile;
+	}
+	else
+	{
+		band_h = ( ctx->bin == BMP_BIN_OTSU ) ? height : 1;
+		tile_w = width;
+	}
+	nb_tiles = ( width + tile_w - 1 ) / tile_w;
+
+	band = gf_malloc( (size_t) band_h * width );
+	thresh = gf_malloc( nb_tiles * sizeof( u32 ) );
+	if ( ctx->bin == BMP_BIN_OTSU )
+		hist = gf_malloc( nb_tiles * 256 * sizeof( u32 ) );
+	if ( !band || !thresh || ( ctx->bin == BMP_BIN_OTSU && !hist ) )
+	{
+		if ( band ) gf_free( band );
+		if ( thresh ) gf_free( thresh );
+		if ( hist ) gf_free( hist );
+		QDBMP_discard_packet( ctx, *dst_pck );
+		*dst_pck = NULL;
+		return GF_OUT_OF_MEM;
+	}
+	thresh[ 0 ] = ctx->thresh;
+
+	for ( y = 0; y < height; y += band_h )
+	{
+		if ( QDBMP_timed_out( ctx ) )
+		{
+			gf_free( band );
+			gf_free( thresh );
+			if ( hist ) gf_free( hist );
+			QDBMP_discard_packet( ctx, *dst_pck );
+			*dst_pck = NULL;
+			return QDBMP_LIMIT_ERR;
+		}
+
+		rows = MIN( band_h, height - y );
+		if ( hist )
+			memset( hist, 0, nb_tiles * 256 * sizeof( u32 ) );
+
+		for ( i = 0; i < rows; i++ )
+		{
+			u8 *grey = band + i * width;
+			GreyRow( grey, BMP_SOURCE_ROW( src, y + i ), width, src->bpp, src->grey_lut, ctx->channel, ctx->grey );
+			if ( hist )
+			{
+				for ( j = 0; j < width; j++ )
+					hist[ ( j / tile_w ) * 256 + grey[ j ] ]++;
+			}
+		}
+
+		if ( hist )
+		{
+			for ( j = 0; j < nb_tiles; j++ )
+				thresh[ j ] = OtsuThreshold( hist + j * 256, ctx->thresh );
+		}
+
+		for ( i = 0; i < rows; i++ )
+			PackRow( output + ( y + i ) * stride, band + i * width, width, thresh, tile_w );
+	}
+
+	gf_free( band );
+	gf_free( thresh );
+	if ( hist ) gf_free( hist );
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes a BMP frame into its mosaic cell, scaled to the cell
+	size with nearest neighbour sampling.
+**************************************************************/
+static GF_Err QDBMP_decode_cell(GF_QDBMPCtx *ctx, u32 cell, const u8 *data, u32 size)
+{
+	QDBMPSource src;
+	u32 y, stride = ctx->canvas_w * 4;
+	u8 *dst = ctx->canvas + ( cell / ctx->mosaic ) * ctx->cellh * stride + ( cell % ctx->mosaic ) * ctx->cellw * 4;
+	GF_Err e;
+
+	e = QDBMP_error( ReadSource( data, size, ctx->channel, ctx->grey, &src ) );
+	if ( !e )
+		e = QDBMP_check_limits( ctx, &src, (u64) ctx->cellw * ctx->cellh * 4, size );
+	if ( !e )
+		e = QDBMP_error( LocateRows( &src, data, size ) );
+	if ( e )
+		return e;
+
+	for ( y = 0; y < ctx->cellh; y++, dst += stride )
+	{
+		if ( !( y % BMP_TIME_CHECK_ROWS ) && QDBMP_timed_out( ctx ) )
+			return QDBMP_LIMIT_ERR;
+		ScaleColorRow( dst, BMP_SOURCE_ROW( &src, (u64) y * src.height / ctx->cellh ), ctx->cellw, src.width, src.bpp, src.color_lut );
+	}
+	return GF_OK;
+}
+
+/* The mosaic canvas is free again once downstream releases the packet */
+static void QDBMP_canvas_release(GF_Filter *filter, GF_FilterPid *pid, GF_FilterPacket *pck)
+{
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+	ctx->canvas_in_use = GF_FALSE;
+	gf_filter_post_process_task(filter);
+}
+
+/**************************************************************
+	Mosaic mode: decodes the latest frame of each input straight
+	into its cell of the shared canvas. Cells of inputs with no
+	new frame are left untouched.
+**************************************************************/
+static GF_Err QDBMP_process_mosaic(GF_Filter *filter)
+{
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+	GF_FilterPacket *pck, *dst_pck = NULL;
+	u32 i, size, w, h, nb_inputs = 0, nb_eos = 0;
+	const u8 *data;
+	GF_Err e;
+
+	/* The previous frame is still in use downstream, its pixels cannot be overwritten yet */
+	if ( ctx->canvas_in_use || !ctx->opid )
+		return GF_OK;
+
+	/* The grid grows a row at a time as inputs are added, the cells already shown are kept */
+	w = ctx->mosaic * ctx->cellw;
+	h = MAX( 1, ( ctx->nb_cells + ctx->mosaic - 1 ) / ctx->mosaic ) * ctx->cellh;
+	if ( w != ctx->canvas_w || h != ctx->canvas_h )
+	{
+		u8 *canvas = gf_realloc( ctx->canvas, (size_t) w * h * 4 );
+		size_t kept = ( w == ctx->canvas_w ) ? (size_t) w * MIN( h, ctx->canvas_h ) * 4 : 0;
+		if ( !canvas ) return GF_OUT_OF_MEM;
+		memset( canvas + kept, 0, (size_t) w * h * 4 - kept );
+		ctx->canvas = canvas;
+		ctx->canvas_w = w;
+		ctx->canvas_h = h;
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_WIDTH, &PROP_UINT(w));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_HEIGHT, &PROP_UINT(h));
+		gf_filter_pid_set_property(ctx->opid, GF_PROP_PID_STRIDE, &PROP_UINT(4 * w));
+	}
+
+	for ( i = 0; i < ctx->nb_cells; i++ )
+	{
+		GF_FilterPid *ipid = ctx->cells[ i ];
+		if ( !ipid ) continue;
+		nb_inputs++;
+
+		/* Only the latest frame of each input is shown */
+		while ( gf_filter_pid_get_packet_count( ipid ) > 1 )
+		{
+			gf_filter_pid_get_packet( ipid );
+			gf_filter_pid_drop_packet( ipid );
+		}
+		pck = gf_filter_pid_get_packet( ipid );
+		if ( !pck )
+		{
+			if ( gf_filter_pid_is_eos( ipid ) ) nb_eos++;
+			continue;
+		}
+
+		data = gf_filter_pck_get_data( pck, &size );
+		if ( ctx->maxtime )
+			ctx->frame_start = gf_sys_clock_high_res();
+		e = QDBMP_decode_cell( ctx, i, data, size );
+		if ( !e && !dst_pck )
+		{
+			dst_pck = gf_filter_pck_new_shared( ctx->opid, ctx->canvas, ctx->canvas_w * ctx->canvas_h * 4, QDBMP_canvas_release );
+			if ( !dst_pck ) e = GF_OUT_OF_MEM;
+		}
+		if ( !e )
+			gf_filter_pck_merge_properties( pck, dst_pck );
+		gf_filter_pid_drop_packet( ipid );
+	}
+
+	if ( dst_pck )
+	{
+		ctx->canvas_in_use = GF_TRUE;
+		gf_filter_pck_set_dependency_flags( dst_pck, 0 );
+		gf_filter_pck_send( dst_pck );
+		return GF_OK;
+	}
+	if ( nb_inputs && nb_eos == nb_inputs )
+	{
+		gf_filter_pid_set_eos( ctx->opid );
+		return GF_EOS;
+	}
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes the located rows of src to a frame of out_w x out_h
+	pixels, as computed by QDBMP_output_size, and sends it with
+	the properties of pck, the timing of the tar member m of the
+	archive packet pck, or at cts for dur without packet.
+**************************************************************/
+static GF_Err QDBMP_decode_source(GF_QDBMPCtx *ctx, GF_FilterPacket *pck, const TarMember *m, const QDBMPSource *src, u32 out_w, u32 out_h, u32 out_stride, u64 cts, u32 dur)
+{
+	GF_FilterPacket *dst_pck;
+	Bool to_grey;
+	GF_Err e;
+	u32 size, pixfmt, codecid;
+	QDBMPCachedFrame *frame;
+
+	/* Greyscale and monochrome outputs are decoded straight from the source rows */
+	to_grey = ( ctx->channel || ctx->grey || ctx->bin ) ? GF_TRUE : GF_FALSE;
+	ctx->palette_size = 0;
+
+	if ( ctx->bin )
+		e = QDBMP_binarize( ctx, src, out_stride, &dst_pck );
+	else if ( ctx->qoi && !to_grey )
+		e = QDBMP_encode_qoi( ctx, src, out_w, out_h, out_stride, &dst_pck );
+	else
+		e = QDBMP_decode_plane( ctx, src, to_grey, out_w, out_h, &out_stride, &dst_pck );
+	if ( e )
+		return e;
+
+	codecid = ( ctx->qoi && !to_grey ) ? QDBMP_CODECID_QOI : GF_CODECID_RAW;
+	/* Tiled frames have no stride */
+	if ( codecid != GF_CODECID_RAW || QDBMP_is_tiled( ctx, to_grey ) )
+		out_stride = 0;
+	QDBMP_set_frame_props( ctx, codecid, 0, out_w, out_h, out_stride, src->width, src->height, ctx->colors.colors, ctx->palette_size );
+
+	if ( ctx->cache )
+	{
+		/* The pixel format was set by the decoding function, QOI frames keep the current one */
+		if ( ctx->bin ) pixfmt = QDBMP_PIXEL_MONO;
+		else if ( codecid == QDBMP_CODECID_QOI ) pixfmt = 0;
+		else if ( ctx->palette_size ) pixfmt = ( ctx->palette_size <= 16 ) ? QDBMP_PIXEL_PAL4 : QDBMP_PIXEL_PAL8;
+		else pixfmt = to_grey ? GF_PIXEL_GREYSCALE : GF_PIXEL_RGBX;
+		gf_filter_pck_get_data( dst_pck, &size );
+		frame = ctx->pending;
+		QDBMP_cache_insert( ctx, size, cts, dur, codecid, pixfmt, out_w, out_h, out_stride, src->width, src->height );
+
+		/* Speculative frames before the playhead are only cached */
+		if ( cts != GF_FILTER_NO_TS && cts < ctx->play_from )
+		{
+			QDBMP_cache_keep( ctx, frame, dst_pck );
+			return GF_OK;
+		}
+		if ( cts != GF_FILTER_NO_TS )
+			ctx->playhead = cts;
+	}
+
+	if ( pck )
+	{
+		gf_filter_pck_merge_properties(pck, dst_pck);
+	}
+	else
+	{
+		gf_filter_pck_set_cts( dst_pck, cts );
+		gf_filter_pck_set_duration( dst_pck, dur );
+		gf_filter_pck_set_sap( dst_pck, GF_FILTER_SAP_1 );
+	}
+	if ( m )
+		QDBMP_set_member_props( ctx, dst_pck, m, cts );
+	gf_filter_pck_set_dependency_flags(dst_pck, 0);
+	gf_filter_pck_send(dst_pck);
+	return GF_OK;
+}
+
+/**************************************************************
+	Decodes one BMP or QOI image of size bytes at data, from the
+	input packet pck or from the tar member m of the archive
+	packet pck, and sends the frame at cts. BMP images are
+	cropped to the region, if any.
+**************************************************************/
+static GF_Err QDBMP_decode_frame(GF_QDBMPCtx *ctx, GF_FilterPacket *pck, const TarMember *m, const u8 *data, u32 size, u64 cts, u32 dur)
+{
+	u32 out_w, out_h, out_stride;
+	QDBMPSource src;
+	Bool to_grey;
+	GF_Err e;
+	u64 out_size;
+	QDBMPCachedFrame *frame;
+
+	if ( ctx->maxtime )
+		ctx->frame_start = gf_sys_clock_high_res();
+	if ( cts != GF_FILTER_NO_TS )
+		ctx->source_cts = cts + dur;
+
+	if ( size >= QOI_HEADER_SIZE + QOI_END_SIZE && !memcmp( data, "qoif", 4 ) )
+		return QDBMP_process_qoi( ctx, pck, m, data, size, cts );
+
+	if ( ctx->cache && cts != GF_FILTER_NO_TS )
+	{
+		/* Frames before the scrub window are skipped, cached frames are not decoded again */
+		if ( cts < ctx->decode_from )
+			return GF_OK;
+		gf_mx_p( ctx->cache_mx );
+		frame = QDBMP_cache_find( ctx, cts, GF_FALSE );
+		gf_mx_v( ctx->cache_mx );
+		if ( frame )
+			return ( cts >= ctx->play_from ) ? QDBMP_cache_send( ctx, frame, m ? NULL : pck ) : GF_OK;
+	}
+
+	to_grey = ( ctx->channel || ctx->grey || ctx->bin ) ? GF_TRUE : GF_FALSE;
+
+	/* Enforce the resource limits before anything is allocated, rejected frames are dropped */
+	e = QDBMP_error( ReadSource( data, size, ctx->channel, ctx->grey, &src ) );
+	if ( !e && ctx->roiw && ctx->roih )
+		e = QDBMP_error( CropSource( &src, ctx->roix, ctx->roiy, ctx->roiw, ctx->roih ) );
+	if ( !e )
+	{
+		out_size = QDBMP_output_size( ctx, &src, to_grey, &out_w, &out_h, &out_stride );
+		e = QDBMP_check_limits( ctx, &src, out_size, size );
+	}
+	if ( !e )
+		e = QDBMP_error( LocateRows( &src, data, size ) );
+	if ( e )
+		return e;
+
+	return QDBMP_decode_source( ctx, pck, m, &src, out_w, out_h, out_stride, cts, dur );
+}
+
+/**************************************************************
+	Decodes the next member of the current tar archive.
+**************************************************************/
+static GF_Err QDBMP_process_archive(GF_Filter *filter, GF_QDBMPCtx *ctx)
+{
+	const TarMember *m = &ctx->members[ ctx->member ];
+	const u8 *data;
+	u32 size;
+	u64 cts = (u64) ctx->member * ctx->fps.den;
+
+	data = gf_filter_pck_get_data( ctx->archive, &size );
+	ctx->member++;
+	ctx->input_offset = GF_FILTER_NO_BO;
+	/* No input packet wakes the filter up for the next members */
+	gf_filter_post_process_task(filter);
+	return QDBMP_decode_frame( ctx, ctx->archive, m, data + m->offset, (u32) m->size, cts, ctx->fps.den );
+}
+
+/* Byte-range mode: makes room for size bytes in the gathering buffer */
+static GF_Err QDBMP_range_alloc(GF_QDBMPCtx *ctx, u64 size)
+{
+	u8 *buf;
+
+	if ( size <= ctx->range_alloc )
+		return GF_OK;
+	if ( size > 0xFFFFFFFF )
+		return GF_OUT_OF_MEM;
+	buf = gf_realloc( ctx->range_buf, (u32) size );
+	if ( !buf )
+		return GF_OUT_OF_MEM;
+	ctx->range_buf = buf;
+	ctx->range_alloc = (u32) size;
+	return GF_OK;
+}
+
+/**************************************************************
+	Byte-range mode: copies the bytes of an input packet found
+	at file offset off that continue the header or the current
+	region row. Other bytes are ignored, they come from reads
+	issued before the last request.
+**************************************************************/
+static void QDBMP_range_gather(GF_QDBMPCtx *ctx, const u8 *data, u32 size, u64 off)
+{
+	const QDBMPSource *src = &ctx->range_src;
+	u64 want;
+	u32 n;
+
+	if ( ctx->range_state == QDBMP_RANGE_HEADER )
+	{
+		if ( ctx->range_fill >= off && ctx->range_fill < off + size )
+		{
+			n = (u32) MIN( QDBMP_RANGE_HEADER_SIZE - ctx->range_fill, off + size - ctx->range_fill );
+			memcpy( ctx->range_buf + ctx->range_fill, data + ( ctx->range_fill - off ), n );
+			ctx->range_fill += n;
+		}
+		return;
+	}
+
+	while ( ctx->range_row < src->height )
+	{
+		want = src->data_offset + (u64) ctx->range_row * src->stride + ctx->range_fill;
+		if ( want < off || want >= off + size )
+			break;
+		n = (u32) MIN( ctx->range_row_size - ctx->range_fill, off + size - want );
+		memcpy( ctx->range_buf + (u64) ctx->range_row * ctx->range_row_size + ctx->range_fill, data + ( want - off ), n );
+		ctx->range_fill += n;
+		if ( ctx->range_fill < ctx->range_row_size )
+			break;
+		ctx->range_row++;
+		ctx->range_fill = 0;
+	}
+}
+
+/**************************************************************
+	Byte-range mode: parses the gathered header, crops it to the
+	region and enforces the limits before requesting the first
+	region rows.
+**************************************************************/
+static GF_Err QDBMP_range_start(GF_QDBMPCtx *ctx)
+{
+	QDBMPSource *src = &ctx->range_src;
+	u32 out_w, out_h, out_stride;
+	Bool to_grey;
+	GF_Err e;
+	u64 out_size;
+
+	to_grey = ( ctx->channel || ctx->grey || ctx->bin ) ? GF_TRUE : GF_FALSE;
+
+	e = QDBMP_error( ReadSource( ctx->range_buf, ctx->range_fill, ctx->channel, ctx->grey, src ) );
+	if ( !e )
+		e = QDBMP_error( CropSource( src, ctx->roix, ctx->roiy, ctx->roiw, ctx->roih ) );
+	if ( e )
+		return e;
+
+	/* Rows are gathered without the bytes around the region */
+	ctx->range_row_size = (u32) ( ( (u64) src->width * src->bpp + 7 ) / 8 );
+	out_size = QDBMP_output_size( ctx, src, to_grey, &out_w, &out_h, &out_stride );
+	e = QDBMP_check_limits( ctx, src, out_size, (u32) MIN( (u64) ctx->range_row_size * src->height, 0xFFFFFFFF ) );
+	if ( e )
+		return e;
+	if ( src->data_offset + src->data_size > ctx->file_size )
+		return GF_CORRUPTED_DATA;
+	e = QDBMP_range_alloc( ctx, (u64) ctx->range_row_size * src->height );
+	if ( e )
+		return e;
+
+	ctx->range_state = QDBMP_RANGE_ROWS;
+	ctx->range_row = ctx->range_fill = 0;
+	QDBMP_range_request( ctx );
+	return GF_OK;
+}
+
+/* Byte-range mode: decodes the gathered region rows */
+static GF_Err QDBMP_range_decode(GF_QDBMPCtx *ctx)
+{
+	QDBMPSource src = ctx->range_src;
+	u32 out_w, out_h, out_stride;
+	Bool to_grey;
+
+	ctx->range_state = QDBMP_RANGE_DONE;
+	GF_LOG(GF_LOG_DEBUG, GF_LOG_CODEC, ("[QDBMP] %ux%u region fetched with "LLU" bytes of a "LLU" bytes file\n", src.width, src.height, ctx->range_bytes, ctx->file_size));
+
+	if ( ctx->maxtime )
+		ctx->frame_start = gf_sys_clock_high_res();
+
+	src.pixels = ctx->range_buf;
+	src.stride = ctx->range_row_size;
+	to_grey = ( ctx->channel || ctx->grey || ctx->bin ) ? GF_TRUE : GF_FALSE;
+	QDBMP_output_size( ctx, &src, to_grey, &out_w, &out_h, &out_stride );
+	return QDBMP_decode_source( ctx, NULL, NULL, &src, out_w, out_h, out_stride, 0, 0 );
+}
+
+/**************************************************************
+	Byte-range mode: gathers the header, then the region rows,
+	from the input packets, requests the next rows as each
+	request completes, and decodes the region once complete.
+**************************************************************/
+static GF_Err QDBMP_process_ranged(GF_QDBMPCtx *ctx)
+{
+	GF_FilterPacket *pck;
+	const u8 *data;
+	u32 size;
+	u64 off;
+	GF_Err e = GF_OK;
+
+	if ( ctx->range_state == QDBMP_RANGE_HEADER )
+		e = QDBMP_range_alloc( ctx, QDBMP_RANGE_HEADER_SIZE );
+
+	while ( !e && ( pck = gf_filter_pid_get_packet( ctx->ipid ) ) )
+	{
+		/* Sources without byte offsets deliver contiguous data */
+		data = gf_filter_pck_get_data( pck, &size );
+		off = gf_filter_pck_get_byte_offset( pck );
+		if ( off == GF_FILTER_NO_BO )
+			off = ctx->range_pos;
+		ctx->range_pos = off + size;
+		if ( ctx->range_state != QDBMP_RANGE_DONE )
+		{
+			ctx->range_bytes += size;
+			QDBMP_range_gather( ctx, data, size, off );
+		}
+		gf_filter_pid_drop_packet( ctx->ipid );
+
+		if ( ctx->range_state == QDBMP_RANGE_HEADER && ctx->range_fill == MIN( QDBMP_RANGE_HEADER_SIZE, ctx->file_size ) )
+			e = QDBMP_range_start( ctx );
+		else if ( ctx->range_state == QDBMP_RANGE_ROWS && ctx->range_row == ctx->range_src.height )
+			e = QDBMP_range_decode( ctx );
+		else if ( ctx->range_state == QDBMP_RANGE_ROWS && ctx->range_row == ctx->range_end_row )
+			QDBMP_range_request( ctx );
+	}
+	if ( e )
+	{
+		ctx->range_state = QDBMP_RANGE_DONE;
+		return e;
+	}
+
+	/* The source ends each request, only the end of the frame ends the output */
+	if ( ctx->range_state == QDBMP_RANGE_DONE && gf_filter_pid_is_eos( ctx->ipid ) )
+	{
+		if (ctx->opid)
+			gf_filter_pid_set_eos(ctx->opid);
+		return GF_EOS;
+	}
+	return GF_OK;
+}
+
+/**************************************************************
+	Reads the specified BMP image file.
+**************************************************************/
+static GF_Err QDBMP_process(GF_Filter *filter)
+{
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+	GF_FilterPacket *pck;
+	u8 *data;
+	u32 size;
+	GF_Err e;
+
+	if ( ctx->mosaic )
+		return QDBMP_process_mosaic( filter );
+
+	if ( ctx->serving )
+	{
+		e = QDBMP_cache_serve( filter, ctx );
+		/* A prefetching source is read meanwhile, and continues once serving ends */
+		if ( e || !ctx->prefetch )
+			return e;
+	}
+
+	if ( ctx->ranged )
+		return QDBMP_process_ranged( ctx );
+
+	if ( ctx->archive && ctx->member < ctx->nb_members )
+		return QDBMP_process_archive( filter, ctx );
+
+	pck = gf_filter_pid_get_packet(ctx->ipid);
+	if (!pck)
+	{
+		/* The last archive is kept for seeking, the stream goes on while cached frames are served */
+		if (!ctx->serving && gf_filter_pid_is_eos(ctx->ipid))
+		{
+			if (ctx->opid)
+				gf_filter_pid_set_eos(ctx->opid);
+			return GF_EOS;
+		}
+		return GF_OK;
+	}
+	data = (unsigned char *)gf_filter_pck_get_data(pck, &size);
+
+	if ( IsTarArchive( data, size ) )
+	{
+		e = QDBMP_open_archive( ctx, pck, data, size );
+		gf_filter_pid_drop_packet(ctx->ipid);
+		return e ? e : QDBMP_process_archive( filter, ctx );
+	}
+	QDBMP_close_archive( ctx );
+
+	if ( ctx->cache )
+	{
+		ctx->timescale = gf_filter_pck_get_timescale( pck );
+		ctx->input_offset = gf_filter_pck_get_byte_offset( pck );
+		if ( ctx->input_offset != GF_FILTER_NO_BO )
+			ctx->input_offset += size;
+	}
+	e = QDBMP_decode_frame( ctx, pck, NULL, data, size, gf_filter_pck_get_cts( pck ), gf_filter_pck_get_duration( pck ) );
+	gf_filter_pid_drop_packet(ctx->ipid);
+	return e;
+}
+
+
+static GF_Err QDBMP_initialize(GF_Filter *filter)
+{
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+
+	if ( ctx->mosaic )
+	{
+		if ( !ctx->cellw || !ctx->cellh )
+			return GF_BAD_PARAM;
+		gf_filter_set_max_extra_input_pids(filter, (u32) -1);
+	}
+	/* Z order interleaves the bits of the coordinates within a tile */
+	if ( ctx->morton && ( !ctx->tile || ( ctx->tile & ( ctx->tile - 1 ) ) || ctx->tile > 0x10000 ) )
+		return GF_BAD_PARAM;
+	if ( ctx->cache )
+		ctx->cache_mx = gf_mx_new("QDBMPCache");
+	return GF_OK;
+}
+
+static void QDBMP_finalize(GF_Filter *filter)
+{
+	GF_QDBMPCtx *ctx = gf_filter_get_udta(filter);
+
+	if ( ctx->cells ) gf_free( ctx->cells );
+	if ( ctx->canvas ) gf_free( ctx->canvas );
+	if ( ctx->tile_row ) gf_free( ctx->tile_row );
+	if ( ctx->range_buf ) gf_free( ctx->range_buf );
+
+	QDBMP_close_archive( ctx );
+	if ( ctx->members ) gf_free( ctx->members );
+
+	while ( ctx->nb_frames )
+		QDBMP_cache_free( ctx->frames[ --ctx->nb_frames ] );
+	if ( ctx->frames ) gf_free( ctx->frames );
+	if ( ctx->cache_mx ) gf_mx_del( ctx->cache_mx );
+
+	if ( ctx->nb_rej_pix || ctx->nb_rej_bytes || ctx->nb_rej_time || ctx->nb_rej_ratio )
+	{
+		GF_LOG(GF_LOG_INFO, GF_LOG_CODEC, ("[QDBMP] Frames rejected by resource limits: %u pixel count, %u output size, %u decode time, %u expansion ratio\n",
+			ctx->nb_rej_pix, ctx->nb_rej_bytes, ctx->nb_rej_time, ctx->nb_rej_ratio));
+	}
+}
+
+#define OFFS(_n)	#_n, offsetof(GF_QDBMPCtx, _n)
+
+static const GF_FilterArgs QDBMPArgs[] =
+{
+	{ OFFS(channel), "decode a single channel into a greyscale plane\n"
+	"- none: decode all channels\n"
+	"- R: red channel\n"
+	"- G: green channel\n"
+	"- B: blue channel\n"
+	"- A: alpha channel, opaque for images without alpha", GF_PROP_UINT, "none", "none|R|G|B|A", GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(grey), "decode to a greyscale luma plane, ignored if `channel` is set\n"
+	"- no: decode to color\n"
+	"- bt601: BT.601 luma weights\n"
+	"- bt709: BT.709 luma weights", GF_PROP_UINT, "no", "no|bt601|bt709", GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(bin), "binarize to packed 1 bit per pixel (MSB first, set bits are white, pixel format `MON1`) from the `channel` or `grey` plane, BT.601 luma by default. 1 BPP images are only flipped\n"
+	"- no: no binarization\n"
+	"- global: use `thresh` for the whole image\n"
+	"- otsu: use the Otsu threshold of each `bintile` tile", GF_PROP_UINT, "no", "no|global|otsu", GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(thresh), "binarization threshold, also used for low contrast Otsu tiles", GF_PROP_UINT, "128", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(bintile), "tile size in pixels for Otsu binarization, 0 for a single threshold over the whole image", GF_PROP_UINT, "64", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(padw), "pad output width to a multiple of this value, replicating the right edge (ignored with `bin`)", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(padh), "pad output height to a multiple of this value, replicating the bottom edge (ignored with `bin`)", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(border), "add a border of this many replicated edge pixels around the output (ignored with `bin`)", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(roix), "horizontal position of the region to decode", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(roiy), "vertical position of the region to decode, from the top", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(roiw), "width of the region of BMP images to decode, clamped to the image; 0 decodes whole images. Regions of 1 and 4 BPP images start on a whole byte. For BMP sources of known size, only the header and the rows of the region are fetched from the source, by byte ranges", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(roih), "height of the region to decode, clamped to the image; 0 decodes whole images", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(tile), "store color and greyscale frames as square tiles of this many pixels, row by row, each tile holding its pixels contiguously; frames are padded to whole tiles by edge replication and announce the tile geometry (properties `QTSZ`, `QTCL` and `QTOR`) instead of a stride. 0 keeps rows (ignored with `bin` and color `qoi`)", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(morton), "store the pixels of each tile in Z order (Morton order) instead of rows, `tile` must be a power of two", GF_PROP_BOOL, "false", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(qoi), "encode color frames as lossless QOI images (codec `QOIF`) instead of raw RGBX, for compact caching; QOI inputs are decoded back to raw frames", GF_PROP_BOOL, "false", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(indexed), "count the distinct colors of raw color frames while decoding, and output frames of at most 256 colors as 8 BPP palette indices (pixel format `PAL8`), or packed 4 BPP indices for up to 16 colors (`PAL4`, high nibble first), with their RGBX palette in the `QPAL` property; tiled frames stay RGBX", GF_PROP_BOOL, "false", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(cache), "keep decoded frames around the playhead for scrubbing, up to this many bytes, and decode ahead when scrubbing backward; seeks landing on a cached frame are served from it without seeking the source. 0 disables", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(fps), "frame rate of the images of tar archive inputs, which are decoded in archive order", GF_PROP_FRACTION, "25/1", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(mosaic), "accept several inputs and decode the latest frame of each into a cell of a single RGBX frame, with this many cells per row; 0 disables. Other output options are ignored", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(cellw), "width of a mosaic cell, frames are scaled to fit", GF_PROP_UINT, "320", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(cellh), "height of a mosaic cell, frames are scaled to fit", GF_PROP_UINT, "240", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(maxpix), "reject frames with more pixels than this value, 0 for no limit", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(maxbytes), "reject frames whose output is larger than this many bytes, 0 for no limit", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(maxtime), "abort frames taking longer than this many milliseconds to decode, 0 for no limit", GF_PROP_UINT, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{ OFFS(maxratio), "reject frames whose output is more than this many times larger than their input, 0 for no limit", GF_PROP_DOUBLE, "0", NULL, GF_FS_ARG_HINT_ADVANCED},
+	{0}
+};
+
 GF_FilterRegister QDBMPRegister = {
 	.name = "QDBMP",
 	.version = "1.0.0",
@@ -531,10 +2016,14 @@ GF_FilterRegister QDBMPRegister = {
 	GF_FS_SET_HELP("QDBMP (Quick n' Dirty BMP) is a minimalistic C library for handling BMP image files.")
 	.private_size = sizeof(GF_QDBMPCtx),
 	.priority = 1,
+	.args = QDBMPArgs,
 	SETCAPS(QDBMPFullCaps),
+	.initialize = QDBMP_initialize,
+	.finalize = QDBMP_finalize,
 	.configure_pid = QDBMP_configure_pid,
 	.probe_data = QDBMP_probe_data,
 	.process = QDBMP_process,
+	.process_event = QDBMP_process_event,
 };
 
 const GF_FilterRegister * EMSCRIPTEN_KEEPALIVE dynCall_QDBMP_register(GF_FilterSession *session)
@@ -0,0 +1,427 @@
+/*
+**
+** Asynchronous decoder. Submitted jobs are queued and taken together by a dispatcher thread,
+** which parses their headers and runs them as one run of the process-wide pool: large frames
+** are split into bands of rows decoded in parallel, small frames are grouped so that a task
+** amortizes its scheduling over several of them. Jobs submitted while a run is in progress
+** are coalesced into the next one. The last task touching a job completes it.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_async.h"
+#include "qdbmp_pool.h"
+#include "qdbmp_trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct _AsyncJob
+{
+	struct _AsyncJob *next;
+	AsyncDecoder *decoder;
+	const u8 *data;
+	u64 size;
+	/* Destination, allocated by the decoder when not given */
+	u8 *dst;
+	u64 dst_size;
+	u32 dst_stride, pixel_size;
+	Bool own_dst;
+	AsyncCallback cb;
+	void *udta;
+
+	QDBMPSource src;
+	/* Tasks of the run still to complete the job */
+	u32 remaining;
+	BMP_STATUS status;
+	/* Set with release ordering once status is final, read without the decoder, which may be closed */
+	Bool done;
+};
+
+struct _AsyncDecoder
+{
+	PoolGroup *pool;
+	pthread_t thread;
+	/* Protects the queue and the completion of jobs */
+	pthread_mutex_t lock;
+	pthread_cond_t queued, completed;
+	AsyncJob *first, *last;
+	Bool stop;
+};
+
+/* Task of a run: rows y to end of a banded job, or whole jobs first to first + nb - 1 */
+typedef struct
+{
+	u32 first, nb;
+	u32 y, end;
+} AsyncTask;
+
+/* Run of the dispatcher */
+typedef struct
+{
+	AsyncJob **jobs;
+	AsyncTask *tasks;
+} AsyncRun;
+
+
+/**************************************************************
+	Marks a job complete, wakes up its waiters and calls its
+	callback.
+**************************************************************/
+static void AsyncComplete( AsyncJob* job, BMP_STATUS status )
+{
+	AsyncDecoder *d = job->decoder;
+	AsyncCallback cb = job->cb;
+	void *udta = job->udta;
+
+	pthread_mutex_lock( &d->lock );
+	job->status = status;
+	__atomic_store_n( &job->done, GF_TRUE, __ATOMIC_RELEASE );
+	pthread_cond_broadcast( &d->completed );
+	pthread_mutex_unlock( &d->lock );
+	/* The callback may free the job */
+	if ( cb ) cb( udta, job, status );
+}
+
+
+/* Decodes rows y to end of a job */
+static void AsyncDecodeRows( AsyncJob* job, u32 y, u32 end )
+{
+	const QDBMPSource *src = &job->src;
+
+	for ( ; y < end; y++ )
+	{
+		u8 *row = job->dst + (u64) y * job->dst_stride;
+		if ( job->pixel_size == 1 )
+			GreyRow( row, BMP_SOURCE_ROW( src, y ), src->width, src->bpp, src->grey_lut, 0, 1 );
+		else
+			ColorRow( row, BMP_SOURCE_ROW( src, y ), src->width, src->bpp, src->color_lut );
+	}
+}
+
+
+/* Pool task: decodes a band or a group of jobs, completing the jobs it finishes */
+static void AsyncDecodeTask( void* arg, u32 index, u32 thread )
+{
+	AsyncRun *run = arg;
+	AsyncTask *t = &run->tasks[ index ];
+	AsyncJob *job;
+	u64 start = TraceEnabled ? TraceNow() : 0;
+	u32 i;
+
+	(void) thread;
+
+	for ( i = 0; i < t->nb; i++ )
+	{
+		job = run->jobs[ t->first + i ];
+		if ( t->nb == 1 )
+			AsyncDecodeRows( job, t->y, t->end );
+		else
+			AsyncDecodeRows( job, 0, job->src.height );
+		if ( __atomic_sub_fetch( &job->remaining, 1, __ATOMIC_ACQ_REL ) == 0 )
+			AsyncComplete( job, BMP_OK );
+	}
+	if ( TraceEnabled ) TraceSpan( t->nb > 1 ? "async decode group" : "async decode", NULL, start, TraceNow() );
+}
+
+
+/**************************************************************
+	Parses a job and sets its destination up.
+	Returns BMP_OK on success.
+**************************************************************/
+static BMP_STATUS AsyncPrepare( AsyncJob* job )
+{
+	u64 size;
+	BMP_STATUS status;
+
+	status = ReadSource( job->data, job->size, 0, ( job->pixel_size == 1 ) ? 1 : 0, &job->src );
+	if ( status == BMP_OK )
+		status = LocateRows( &job->src, job->data, job->size );
+	if ( status != BMP_OK )
+		return status;
+
+	if ( !job->dst )
+	{
+		job->dst_stride = job->src.width * job->pixel_size;
+		size = (u64) job->dst_stride * job->src.height;
+		if ( size != (size_t) size || !( job->dst = malloc( (size_t) MAX( size, 1 ) ) ) )
+			return BMP_OUT_OF_MEMORY;
+		job->dst_size = size;
+		job->own_dst = GF_TRUE;
+	}
+	/* The last row only needs its pixels */
+	if ( job->src.height && ( job->dst_stride < (u64) job->src.width * job->pixel_size
+		|| (u64) ( job->src.height - 1 ) * job->dst_stride + (u64) job->src.width * job->pixel_size > job->dst_size ) )
+		return BMP_INVALID_ARGUMENT;
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Runs a batch of queued jobs: failed jobs complete at once,
+	the others are split or grouped into tasks of about
+	ASYNC_TASK_PIXELS pixels run by the pool.
+**************************************************************/
+static void AsyncRunBatch( AsyncDecoder* d, AsyncJob* batch )
+{
+	AsyncRun run;
+	AsyncJob *job, *next;
+	BMP_STATUS status;
+	u32 nb_jobs = 0, nb_tasks = 0, i, rows;
+	u64 pixels, group = 0;
+
+	for ( job = batch; job; job = job->next )
+		nb_jobs++;
+	run.jobs = malloc( nb_jobs * sizeof( AsyncJob* ) );
+
+	nb_jobs = 0;
+	for ( job = batch; job; job = next )
+	{
+		next = job->next;
+		status = run.jobs ? AsyncPrepare( job ) : BMP_OUT_OF_MEMORY;
+		if ( status != BMP_OK )
+		{
+			AsyncComplete( job, status );
+			continue;
+		}
+		run.jobs[ nb_jobs++ ] = job;
+	}
+	if ( !nb_jobs )
+	{
+		free( run.jobs );
+		return;
+	}
+
+	/* Bands of large jobs are at least ASYNC_TASK_PIXELS / 2 pixels: this bounds the number of tasks */
+	for ( i = 0, pixels = 0; i < nb_jobs; i++ )
+		pixels += (u64) run.jobs[ i ]->src.width * run.jobs[ i ]->src.height / ( ASYNC_TASK_PIXELS / 2 ) + 1;
+	run.tasks = ( pixels == (size_t) pixels ) ? malloc( (size_t) pixels * sizeof( AsyncTask ) ) : NULL;
+	if ( !run.tasks )
+	{
+		for ( i = 0; i < nb_jobs; i++ )
+			AsyncComplete( run.jobs[ i ], BMP_OUT_OF_MEMORY );
+		free( run.jobs );
+		return;
+	}
+
+	for ( i = 0; i < nb_jobs; i++ )
+	{
+		job = run.jobs[ i ];
+		pixels = (u64) job->src.width * job->src.height;
+		if ( pixels > 2 * ASYNC_TASK_PIXELS )
+		{
+			/* Large job: bands of rows, each its own task */
+			u32 y;
+			rows = MAX( 1, ASYNC_TASK_PIXELS / job->src.width );
+			job->remaining = ( job->src.height + rows - 1 ) / rows;
+			for ( y = 0; y < job->src.height; y += rows )
+			{
+				run.tasks[ nb_tasks ].first = i;
+				run.tasks[ nb_tasks ].nb = 1;
+				run.tasks[ nb_tasks ].y = y;
+				run.tasks[ nb_tasks ].end = MIN( y + rows, job->src.height );
+				nb_tasks++;
+			}
+			group = 0;
+			continue;
+		}
+
+		/* Small job: appended to the previous group of small jobs until it reaches ASYNC_TASK_PIXELS */
+		job->remaining = 1;
+		if ( group && group + pixels <= ASYNC_TASK_PIXELS )
+		{
+			run.tasks[ nb_tasks - 1 ].nb++;
+			group += pixels;
+			continue;
+		}
+		run.tasks[ nb_tasks ].first = i;
+		run.tasks[ nb_tasks ].nb = 1;
+		run.tasks[ nb_tasks ].y = 0;
+		run.tasks[ nb_tasks ].end = job->src.height;
+		nb_tasks++;
+		group = MAX( pixels, 1 );
+	}
+
+	PoolRun( d->pool, AsyncDecodeTask, &run, nb_tasks );
+	free( run.tasks );
+	free( run.jobs );
+}
+
+
+/* Dispatcher thread: runs the queued jobs until the decoder is closed and the queue drained */
+static void* AsyncDispatch( void* arg )
+{
+	AsyncDecoder *d = arg;
+	AsyncJob *batch;
+
+	TraceThreadName( "async dispatcher", -1 );
+	pthread_mutex_lock( &d->lock );
+	while ( 1 )
+	{
+		while ( !d->first && !d->stop )
+			pthread_cond_wait( &d->queued, &d->lock );
+		batch = d->first;
+		if ( !batch ) break;
+		d->first = d->last = NULL;
+		pthread_mutex_unlock( &d->lock );
+
+		AsyncRunBatch( d, batch );
+		pthread_mutex_lock( &d->lock );
+	}
+	pthread_mutex_unlock( &d->lock );
+	return NULL;
+}
+
+
+/**************************************************************
+	Creates a decoder, starting the process-wide pool with one
+	thread per core if needed. Realtime decoders are served
+	before the other pool users. Returns NULL on error.
+**************************************************************/
+AsyncDecoder* AsyncOpen( Bool realtime )
+{
+	AsyncDecoder *d = calloc( 1, sizeof( AsyncDecoder ) );
+
+	if ( !d ) return NULL;
+	d->pool = PoolGroupNew( realtime );
+	pthread_mutex_init( &d->lock, NULL );
+	pthread_cond_init( &d->queued, NULL );
+	pthread_cond_init( &d->completed, NULL );
+	if ( !d->pool || pthread_create( &d->thread, NULL, AsyncDispatch, d ) )
+	{
+		PoolGroupDel( d->pool );
+		pthread_mutex_destroy( &d->lock );
+		pthread_cond_destroy( &d->queued );
+		pthread_cond_destroy( &d->completed );
+		free( d );
+		return NULL;
+	}
+	return d;
+}
+
+
+/**************************************************************
+	Completes the submitted jobs and frees the decoder. Jobs
+	that were not freed stay valid and complete, but must not be
+	waited for from other threads during the close.
+**************************************************************/
+void AsyncClose( AsyncDecoder* d )
+{
+	if ( !d ) return;
+	pthread_mutex_lock( &d->lock );
+	d->stop = GF_TRUE;
+	pthread_cond_signal( &d->queued );
+	pthread_mutex_unlock( &d->lock );
+	pthread_join( d->thread, NULL );
+
+	PoolGroupDel( d->pool );
+	pthread_mutex_destroy( &d->lock );
+	pthread_cond_destroy( &d->queued );
+	pthread_cond_destroy( &d->completed );
+	free( d );
+}
+
+
+/**************************************************************
+	Queues the decoding of the BMP frame in data, which must stay
+	valid until the job completes, into top-down RGBX (pixel_size
+	4) or greyscale (pixel_size 1) rows of dst, dst_stride bytes
+	apart within dst_size bytes. If dst is NULL, the decoder
+	allocates packed rows, read with AsyncJobPixels. cb, if not
+	NULL, is called on completion. Returns the job, or NULL on
+	error.
+**************************************************************/
+AsyncJob* AsyncSubmit( AsyncDecoder* d, const u8* data, u64 size, u8* dst, u32 dst_stride, u64 dst_size, u32 pixel_size, AsyncCallback cb, void* udta )
+{
+	AsyncJob *job;
+
+	if ( !d || !data || ( pixel_size != 1 && pixel_size != 4 ) )
+		return NULL;
+	job = calloc( 1, sizeof( AsyncJob ) );
+	if ( !job ) return NULL;
+	job->decoder = d;
+	job->data = data;
+	job->size = size;
+	job->dst = dst;
+	job->dst_stride = dst_stride;
+	job->dst_size = dst ? dst_size : 0;
+	job->pixel_size = pixel_size;
+	job->cb = cb;
+	job->udta = udta;
+
+	pthread_mutex_lock( &d->lock );
+	if ( d->last ) d->last->next = job;
+	else d->first = job;
+	d->last = job;
+	pthread_cond_signal( &d->queued );
+	pthread_mutex_unlock( &d->lock );
+	return job;
+}
+
+
+/**************************************************************
+	Returns GF_TRUE if the job is complete, with its status.
+**************************************************************/
+Bool AsyncPoll( AsyncJob* job, BMP_STATUS* status )
+{
+	Bool done = __atomic_load_n( &job->done, __ATOMIC_ACQUIRE );
+
+	if ( done && status ) *status = job->status;
+	return done;
+}
+
+
+/**************************************************************
+	Waits for the job to complete. Returns its status.
+**************************************************************/
+BMP_STATUS AsyncWait( AsyncJob* job )
+{
+	AsyncDecoder *d;
+
+	/* Complete jobs may outlive their decoder */
+	if ( __atomic_load_n( &job->done, __ATOMIC_ACQUIRE ) )
+		return job->status;
+
+	d = job->decoder;
+	pthread_mutex_lock( &d->lock );
+	while ( !job->done )
+		pthread_cond_wait( &d->completed, &d->lock );
+	pthread_mutex_unlock( &d->lock );
+	return job->status;
+}
+
+
+/**************************************************************
+	Returns the pixels of a job completed with BMP_OK, with their
+	geometry, or NULL.
+**************************************************************/
+const u8* AsyncJobPixels( const AsyncJob* job, u32* width, u32* height, u32* stride )
+{
+	if ( !__atomic_load_n( &job->done, __ATOMIC_ACQUIRE ) || job->status != BMP_OK )
+		return NULL;
+	if ( width ) *width = job->src.width;
+	if ( height ) *height = job->src.height;
+	if ( stride ) *stride = job->dst_stride;
+	return job->dst;
+}
+
+
+/**************************************************************
+	Frees a completed job, and its pixels if the decoder
+	allocated them. Can be called from the callback.
+**************************************************************/
+void AsyncJobFree( AsyncJob* job )
+{
+	if ( !job ) return;
+	if ( job->own_dst ) free( job->dst );
+	free( job );
+}
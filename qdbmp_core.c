@@ -0,0 +1,1371 @@
+/*
+**
+** Adapted from the qdbmp code; see QDBMP license information in qdbmp.h
+**
+** BMP parsing, row conversion kernels and QOI codec, shared by the QDBMP filter and the native tools.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "qdbmp_core.h"
+
+#include <stdio.h>
+
+const u32 BMP_CHANNEL_OFFSET[ 5 ] = { 0, 2, 1, 0, 3 };
+
+const u32 BMP_LUMA_WEIGHTS[ 3 ][ 3 ] =
+{
+	{ 0, 0, 0 },
+	{ 29, 150, 77 },	/* BT.601 */
+	{ 18, 183, 55 },	/* BT.709 */
+};
+
+/* Holds the last error code */
+static BMP_STATUS BMP_LAST_ERROR_CODE = BMP_OK;
+
+/* Error description strings */
+static const char* BMP_ERROR_STRING[] =
+{
+	"",
+	"General error",
+	"Could not allocate enough memory to complete the operation",
+	"File input/output error",
+	"File not found",
+	"File is not a supported BMP variant (must be uncompressed 32, 24, 8, 4 or 1 BPP)",
+	"File is not a valid BMP image",
+	"An argument is invalid or out of range",
+	"The requested action is not compatible with the BMP's type"
+};
+
+/**************************************************************
+	Reads a little-endian unsigned int from the file.
+	Returns non-zero on success.
+**************************************************************/
+int	ReadUINT( UINT* x, FILE* f )
+{
+	UCHAR little[ 4 ];	/* BMPs use 32 bit ints */
+
+	if ( x == NULL || f == NULL )
+	{
+		return 0;
+	}
+
+	if ( fread( little, 4, 1, f ) != 1 )
+	{
+		return 0;
+	}
+
+	*x = ( (UINT) little[ 3 ] << 24 | little[ 2 ] << 16 | little[ 1 ] << 8 | little[ 0 ] );
+
+	return 1;
+}
+
+
+/**************************************************************
+	Reads a little-endian unsigned short int from the file.
+	Returns non-zero on success.
+**************************************************************/
+int	ReadUSHORT( USHORT *x, FILE* f )
+{
+	UCHAR little[ 2 ];	/* BMPs use 16 bit shorts */
+
+	if ( x == NULL || f == NULL )
+	{
+		return 0;
+	}
+
+	if ( fread( little, 2, 1, f ) != 1 )
+	{
+		return 0;
+	}
+
+	*x = ( little[ 1 ] << 8 | little[ 0 ] );
+
+	return 1;
+}
+
+
+/**************************************************************
+	Writes a little-endian unsigned int to the file.
+	Returns non-zero on success.
+**************************************************************/
+int	WriteUINT( UINT x, FILE* f )
+{
+	UCHAR little[ 4 ];	/* BMPs use 32 bit ints */
+
+	little[ 3 ] = (UCHAR)( ( x & 0xff000000 ) >> 24 );
+	little[ 2 ] = (UCHAR)( ( x & 0x00ff0000 ) >> 16 );
+	little[ 1 ] = (UCHAR)( ( x & 0x0000ff00 ) >> 8 );
+	little[ 0 ] = (UCHAR)( ( x & 0x000000ff ) >> 0 );
+
+	return ( f && fwrite( little, 4, 1, f ) == 1 );
+}
+
+
+/**************************************************************
+	Writes a little-endian unsigned short int to the file.
+	Returns non-zero on success.
+**************************************************************/
+int	WriteUSHORT( USHORT x, FILE* f )
+{
+	UCHAR little[ 2 ];	/* BMPs use 16 bit shorts */
+
+	little[ 1 ] = (UCHAR)( ( x & 0xff00 ) >> 8 );
+	little[ 0 ] = (UCHAR)( ( x & 0x00ff ) >> 0 );
+
+	return ( f && fwrite( little, 2, 1, f ) == 1 );
+};
+
+/**************************************************************
+	Reads the BMP file's header into the data structure.
+	Returns BMP_OK on success.
+**************************************************************/
+int	ReadHeader( BMP* bmp, FILE* f )
+{
+	if ( bmp == NULL || f == NULL )
+	{
+		return BMP_INVALID_ARGUMENT;
+	}
+
+	/* The header's fields are read one by one, and converted from the format's
+	little endian to the system's native representation. */
+	if ( !ReadUSHORT( &( bmp->Header.Magic ), f ) )			return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.FileSize ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUSHORT( &( bmp->Header.Reserved1 ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUSHORT( &( bmp->Header.Reserved2 ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.DataOffset ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.HeaderSize ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.Width ), f ) )			return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.Height ), f ) )			return BMP_IO_ERROR;
+	if ( !ReadUSHORT( &( bmp->Header.Planes ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUSHORT( &( bmp->Header.BitsPerPixel ), f ) )	return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.CompressionType ), f ) )	return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.ImageDataSize ), f ) )	return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.HPixelsPerMeter ), f ) )	return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.VPixelsPerMeter ), f ) )	return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.ColorsUsed ), f ) )		return BMP_IO_ERROR;
+	if ( !ReadUINT( &( bmp->Header.ColorsRequired ), f ) )	return BMP_IO_ERROR;
+
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Reads the header and palette of an in-memory BMP frame into
+	src, with the palette converted for the channel and grey
+	options. Pixel rows are checked separately by LocateRows, so
+	that callers can enforce their limits first.
+	Returns BMP_OK on success.
+**************************************************************/
+BMP_STATUS ReadSource( const u8* data, u64 size, u32 channel, u32 grey, QDBMPSource* src )
+{
+	BMP bmp;
+	UCHAR palette[ BMP_PALETTE_SIZE_8bpp ];
+	u32 i, palettesize = 0;
+	u64 stride;
+	FILE *f;
+
+	f = fmemopen( (void *) data, (size_t) size, "rb" );
+	if ( f == NULL )
+	{
+		BMP_LAST_ERROR_CODE = BMP_OUT_OF_MEMORY;
+		return BMP_OUT_OF_MEMORY;
+	}
+
+	if ( ReadHeader( &bmp, f ) != BMP_OK || bmp.Header.Magic != 0x4D42 )
+	{
+		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
+		fclose( f );
+		return BMP_FILE_INVALID;
+	}
+
+	if ( bmp.Header.BitsPerPixel == 8 ) palettesize = BMP_PALETTE_SIZE_8bpp;
+	if ( bmp.Header.BitsPerPixel == 4 ) palettesize = BMP_PALETTE_SIZE_4bpp;
+	if ( bmp.Header.BitsPerPixel == 1 ) palettesize = BMP_PALETTE_SIZE_1bpp;
+
+	/* Verify that the bitmap variant is supported */
+	if ( ( bmp.Header.BitsPerPixel != 32 && bmp.Header.BitsPerPixel != 24
+		&& bmp.Header.BitsPerPixel != 8 && bmp.Header.BitsPerPixel != 4
+		&& bmp.Header.BitsPerPixel != 1 )
+		|| bmp.Header.CompressionType != 0 || bmp.Header.HeaderSize != 40 )
+	{
+		BMP_LAST_ERROR_CODE = BMP_FILE_NOT_SUPPORTED;
+		fclose( f );
+		return BMP_FILE_NOT_SUPPORTED;
+	}
+
+	/* Read palette */
+	if ( palettesize > 0 && fread( palette, sizeof( UCHAR ), palettesize, f ) != palettesize )
+	{
+		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
+		fclose( f );
+		return BMP_FILE_INVALID;
+	}
+	fclose( f );
+
+	src->width = BMP_GetWidth( &bmp );
+	src->height = BMP_GetHeight( &bmp );
+	src->bpp = BMP_GetDepth( &bmp );
+	src->top_down = ( (s32) bmp.Header.Height < 0 ) ? GF_TRUE : GF_FALSE;
+	stride = BMP_ROW_STRIDE( (u64) src->width, src->bpp );
+	src->stride = (u32) stride;
+	src->data_offset = bmp.Header.DataOffset;
+	/* Cannot overflow with a stride and height below 2^32 */
+	src->data_size = stride * src->height;
+	src->pixels = NULL;
+	if ( !src->width || !src->height || stride > 0xFFFFFFFF )
+	{
+		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
+		return BMP_FILE_INVALID;
+	}
+
+	/* Indexed images only need the converted value of each palette entry */
+	if ( palettesize > 0 )
+	{
+		const u32 *weights = BMP_LUMA_WEIGHTS[ grey ? grey : 1 ];
+		const u32 offset = BMP_CHANNEL_OFFSET[ channel ];
+		for ( i = 0; i < palettesize / 4; i++ )
+		{
+			const UCHAR *c = palette + 4 * i;
+			if ( !channel )
+				src->grey_lut[ i ] = (u8) ( ( weights[ 0 ] * c[ 0 ] + weights[ 1 ] * c[ 1 ] + weights[ 2 ] * c[ 2 ] + 128 ) >> 8 );
+			else
+				src->grey_lut[ i ] = ( offset == 3 ) ? 0xFF : c[ offset ];
+
+			src->color_lut[ 4 * i ] = c[ 2 ];
+			src->color_lut[ 4 * i + 1 ] = c[ 1 ];
+			src->color_lut[ 4 * i + 2 ] = c[ 0 ];
+			src->color_lut[ 4 * i + 3 ] = 0xFF;
+		}
+	}
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Restricts src to the w x h region at x, y of the image,
+	clamped to its bounds: the size and the pixel data range
+	become the ones of the region, so that only its bytes are
+	needed in the file. For 1 and 4 BPP images, x is rounded
+	down to a whole byte and the region widened accordingly.
+	Returns BMP_OK on success.
+**************************************************************/
+BMP_STATUS CropSource( QDBMPSource* src, u32 x, u32 y, u32 w, u32 h )
+{
+	u32 first, align = ( src->bpp < 8 ) ? 8 / src->bpp : 1;
+
+	if ( x >= src->width || y >= src->height || !w || !h )
+	{
+		BMP_LAST_ERROR_CODE = BMP_INVALID_ARGUMENT;
+		return BMP_INVALID_ARGUMENT;
+	}
+	w = MIN( w, src->width - x ) + x % align;
+	h = MIN( h, src->height - y );
+	x -= x % align;
+
+	/* First row of the region in file order */
+	first = src->top_down ? y : src->height - y - h;
+	src->data_offset += (u64) first * src->stride + (u64) x * src->bpp / 8;
+	src->data_size = (u64) ( h - 1 ) * src->stride + ( (u64) w * src->bpp + 7 ) / 8;
+	src->width = w;
+	src->height = h;
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Rows are read in place, makes sure they are all there and
+	locates them.
+	Returns BMP_OK on success.
+**************************************************************/
+BMP_STATUS LocateRows( QDBMPSource* src, const u8* data, u64 size )
+{
+	if ( src->data_offset + src->data_size > size )
+	{
+		BMP_LAST_ERROR_CODE = BMP_FILE_INVALID;
+		return BMP_FILE_INVALID;
+	}
+	src->pixels = data + src->data_offset;
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Copies a single channel of a truecolor BMP row into a
+	greyscale row. offset is the position of the channel in the
+	BGRX layout; 24 BPP images get an opaque alpha.
+**************************************************************/
+void ExtractChannelRow( u8* dst, const u8* src, u32 width, USHORT bpp, u32 offset )
+{
+	u32 i;
+
+	if ( bpp == 24 && offset == 3 )
+	{
+		memset( dst, 0xFF, width );
+		return;
+	}
+
+	src += offset;
+	if ( bpp == 32 )
+	{
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = src[ 4 * i ];
+	}
+	else
+	{
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = src[ 3 * i ];
+	}
+}
+
+
+/**************************************************************
+	Computes the luma of a truecolor BMP row into a greyscale
+	row, using the fixed point weights w (B, G, R).
+**************************************************************/
+void LumaRow( u8* dst, const u8* src, u32 width, USHORT bpp, const u32* w )
+{
+	u32 i;
+
+	if ( bpp == 32 )
+	{
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = (u8) ( ( w[ 0 ] * src[ 4 * i ] + w[ 1 ] * src[ 4 * i + 1 ] + w[ 2 ] * src[ 4 * i + 2 ] + 128 ) >> 8 );
+	}
+	else
+	{
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = (u8) ( ( w[ 0 ] * src[ 3 * i ] + w[ 1 ] * src[ 3 * i + 1 ] + w[ 2 ] * src[ 3 * i + 2 ] + 128 ) >> 8 );
+	}
+}
+
+
+/**************************************************************
+	Maps an indexed BMP row (8, 4 or 1 BPP) through lut, which
+	holds one greyscale value per palette entry.
+**************************************************************/
+void LookupRow( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut )
+{
+	u32 i;
+
+	switch ( bpp )
+	{
+	case 8:
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = lut[ src[ i ] ];
+		break;
+
+	case 4:
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = lut[ ( src[ i / 2 ] >> ( ( i & 1 ) ? 0 : 4 ) ) & 0x0F ];
+		break;
+
+	case 1:
+		for ( i = 0; i < width; i++ )
+			dst[ i ] = lut[ ( src[ i / 8 ] >> ( 7 - ( i & 7 ) ) ) & 0x01 ];
+		break;
+	}
+}
+
+
+/**************************************************************
+	Computes the Otsu threshold of a 256 bins histogram. Near
+	uniform histograms return fallback, as splitting them would
+	only binarize noise.
+**************************************************************/
+u32 OtsuThreshold( const u32* hist, u32 fallback )
+{
+	u64 total = 0, sum = 0, sum_b = 0, w_b = 0, w_f;
+	u32 t, lo = 256, hi = 0, thresh = fallback;
+	Double m_b, m_f, var, best = -1;
+
+	for ( t = 0; t < 256; t++ )
+	{
+		if ( !hist[ t ] ) continue;
+		total += hist[ t ];
+		sum += (u64) t * hist[ t ];
+		if ( lo == 256 ) lo = t;
+		hi = t;
+	}
+	if ( !total || hi - lo < BMP_OTSU_MIN_SPREAD )
+		return fallback;
+
+	for ( t = 0; t < 255; t++ )
+	{
+		w_b += hist[ t ];
+		sum_b += (u64) t * hist[ t ];
+		if ( !w_b ) continue;
+		w_f = total - w_b;
+		if ( !w_f ) break;
+
+		m_b = (Double) sum_b / w_b;
+		m_f = (Double) ( sum - sum_b ) / w_f;
+		var = (Double) w_b * w_f * ( m_b - m_f ) * ( m_b - m_f );
+		if ( var > best )
+		{
+			best = var;
+			thresh = t + 1;
+		}
+	}
+	return thresh;
+}
+
+
+/**************************************************************
+	Packs a greyscale row into a 1 BPP row, MSB first. Pixels at
+	or above the threshold of their tile are set.
+**************************************************************/
+void PackRow( u8* dst, const u8* grey, u32 width, const u32* thresh, u32 tile_w )
+{
+	u32 i, bits = 0;
+
+	for ( i = 0; i < width; i++ )
+	{
+		bits = ( bits << 1 ) | ( grey[ i ] >= thresh[ i / tile_w ] );
+		if ( ( i & 7 ) == 7 )
+		{
+			dst[ i / 8 ] = (u8) bits;
+			bits = 0;
+		}
+	}
+	if ( width & 7 )
+		dst[ width / 8 ] = (u8) ( bits << ( 8 - ( width & 7 ) ) );
+}
+
+
+/**************************************************************
+	Converts a BMP row to RGBX. lut holds the RGBX color of each
+	palette entry for indexed images.
+**************************************************************/
+void ColorRow( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut )
+{
+	u32 i;
+
+	switch ( bpp )
+	{
+	case 32:
+	case 24:
+		for ( i = 0; i < width; i++, src += bpp / 8, dst += 4 )
+		{
+			dst[ 0 ] = src[ 2 ];
+			dst[ 1 ] = src[ 1 ];
+			dst[ 2 ] = src[ 0 ];
+			dst[ 3 ] = 0xFF;
+		}
+		break;
+
+	case 8:
+		for ( i = 0; i < width; i++ )
+			memcpy( dst + 4 * i, lut + 4 * src[ i ], 4 );
+		break;
+
+	case 4:
+		for ( i = 0; i < width; i++ )
+			memcpy( dst + 4 * i, lut + 4 * ( ( src[ i / 2 ] >> ( ( i & 1 ) ? 0 : 4 ) ) & 0x0F ), 4 );
+		break;
+
+	case 1:
+		for ( i = 0; i < width; i++ )
+			memcpy( dst + 4 * i, lut + 4 * ( ( src[ i / 8 ] >> ( 7 - ( i & 7 ) ) ) & 0x01 ), 4 );
+		break;
+	}
+}
+
+
+/**************************************************************
+	Converts a BMP row of src_width pixels to an RGBX row of
+	width pixels, with nearest neighbour sampling.
+**************************************************************/
+void ScaleColorRow( u8* dst, const u8* src, u32 width, u32 src_width, USHORT bpp, const u8* lut )
+{
+	u32 i, sx;
+	u64 pos = 0, step;
+	const u8 *px;
+
+	if ( width == src_width )
+	{
+		ColorRow( dst, src, width, bpp, lut );
+		return;
+	}
+
+	/* 16.16 fixed point source position */
+	step = ( (u64) src_width << 16 ) / width;
+	for ( i = 0; i < width; i++, pos += step, dst += 4 )
+	{
+		sx = (u32) ( pos >> 16 );
+		switch ( bpp )
+		{
+		case 32:
+		case 24:
+			px = src + sx * ( bpp / 8 );
+			dst[ 0 ] = px[ 2 ];
+			dst[ 1 ] = px[ 1 ];
+			dst[ 2 ] = px[ 0 ];
+			dst[ 3 ] = 0xFF;
+			break;
+		case 8:
+			memcpy( dst, lut + 4 * src[ sx ], 4 );
+			break;
+		case 4:
+			memcpy( dst, lut + 4 * ( ( src[ sx / 2 ] >> ( ( sx & 1 ) ? 0 : 4 ) ) & 0x0F ), 4 );
+			break;
+		case 1:
+			memcpy( dst, lut + 4 * ( ( src[ sx / 8 ] >> ( 7 - ( sx & 7 ) ) ) & 0x01 ), 4 );
+			break;
+		}
+	}
+}
+
+
+/**************************************************************
+	Replicates the first and last visible pixels of a padded
+	row over its left and right margins.
+**************************************************************/
+void PadRow( u8* row, u32 width, u32 left, u32 right, u32 pixel_size )
+{
+	u8 *first = row + left * pixel_size;
+	u8 *last = first + ( width - 1 ) * pixel_size;
+	u32 i;
+
+	for ( i = 0; i < left; i++ )
+		memcpy( row + i * pixel_size, first, pixel_size );
+	for ( i = 1; i <= right; i++ )
+		memcpy( last + i * pixel_size, last, pixel_size );
+}
+
+
+/* Spreads the low 16 bits of v to the even bits of the result */
+static u32 MortonSpread( u32 v )
+{
+	v &= 0xFFFF;
+	v = ( v | ( v << 8 ) ) & 0x00FF00FF;
+	v = ( v | ( v << 4 ) ) & 0x0F0F0F0F;
+	v = ( v | ( v << 2 ) ) & 0x33333333;
+	v = ( v | ( v << 1 ) ) & 0x55555555;
+	return v;
+}
+
+
+/**************************************************************
+	Stores a converted row into a band of square tiles. The band
+	holds the width / tile tiles of one tile row, each stored as
+	tile x tile contiguous pixels, and y is the row within the
+	band. Pixels are in row order within the tiles, or in Z
+	order (Morton order, x bits interleaved with y bits) when
+	morton is set, which needs a power of two tile size.
+**************************************************************/
+void TileRow( u8* band, const u8* row, u32 width, u32 y, u32 tile, Bool morton, u32 pixel_size )
+{
+	u64 tile_size = (u64) tile * tile * pixel_size;
+	u32 x, tx, my;
+	u8 *dst;
+
+	if ( !morton )
+	{
+		for ( tx = 0; tx < width / tile; tx++ )
+			memcpy( band + tx * tile_size + (u64) y * tile * pixel_size, row + (u64) tx * tile * pixel_size, tile * pixel_size );
+		return;
+	}
+
+	/* The y bits are the same for the whole row */
+	my = MortonSpread( y ) << 1;
+	for ( tx = 0; tx < width / tile; tx++ )
+	{
+		dst = band + tx * tile_size;
+		for ( x = 0; x < tile; x++, row += pixel_size )
+			memcpy( dst + (u64) ( MortonSpread( x ) | my ) * pixel_size, row, pixel_size );
+	}
+}
+
+
+/* Stores a little-endian 32 bit value */
+static void PutUINT( u8* p, u32 x )
+{
+	p[ 0 ] = (u8) x;
+	p[ 1 ] = (u8) ( x >> 8 );
+	p[ 2 ] = (u8) ( x >> 16 );
+	p[ 3 ] = (u8) ( x >> 24 );
+}
+
+
+/* 4x4 ordered dither matrix */
+static const u8 Bayer4[ 4 ][ 4 ] =
+{
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 }
+};
+
+
+/**************************************************************
+	Builds the file header, info header and palette or colour
+	masks of an uncompressed bottom-up BMP in out, which must
+	hold BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp bytes. 8 BPP
+	files get a greyscale palette, 16 BPP files are BI_BITFIELDS
+	with the 565 or 555 (BMP_ENCODE_555 in flags) masks.
+	Returns the pixel data offset, or 0 if the depth is not
+	supported or the file would exceed 4 GB.
+**************************************************************/
+u32 BuildHeader( u8* out, u32 width, u32 height, USHORT bpp, u32 flags )
+{
+	u32 i, offset = BMP_HEADER_SIZE;
+	u64 data_size = (u64) BMP_ROW_STRIDE( (u64) width, bpp ) * height;
+
+	if ( bpp != 32 && bpp != 24 && bpp != 16 && bpp != 8 )
+		return 0;
+	if ( bpp == 8 )
+		offset += BMP_PALETTE_SIZE_8bpp;
+	if ( bpp == 16 )
+		offset += BMP_MASKS_SIZE;
+	if ( !width || !height || offset + data_size > 0xFFFFFFFF || height > 0x7FFFFFFF )
+		return 0;
+
+	memset( out, 0, offset );
+	out[ 0 ] = 'B';
+	out[ 1 ] = 'M';
+	PutUINT( out + 2, (u32) ( offset + data_size ) );
+	PutUINT( out + 10, offset );
+	PutUINT( out + 14, 40 );
+	PutUINT( out + 18, width );
+	PutUINT( out + 22, height );
+	out[ 26 ] = 1;
+	out[ 28 ] = (u8) bpp;
+	PutUINT( out + 34, (u32) data_size );
+	PutUINT( out + 38, 2835 );	/* 72 DPI */
+	PutUINT( out + 42, 2835 );
+
+	if ( bpp == 8 )
+	{
+		PutUINT( out + 46, 256 );
+		for ( i = 0; i < 256; i++ )
+			PutUINT( out + BMP_HEADER_SIZE + 4 * i, i * 0x010101 );
+	}
+	else if ( bpp == 16 )
+	{
+		PutUINT( out + 30, 3 );		/* BI_BITFIELDS */
+		PutUINT( out + BMP_HEADER_SIZE, ( flags & BMP_ENCODE_555 ) ? 0x7C00 : 0xF800 );
+		PutUINT( out + BMP_HEADER_SIZE + 4, ( flags & BMP_ENCODE_555 ) ? 0x03E0 : 0x07E0 );
+		PutUINT( out + BMP_HEADER_SIZE + 8, 0x001F );
+	}
+	return offset;
+}
+
+
+/**************************************************************
+	Encodes row y (top-down, for the dither pattern) of RGBX
+	(pixel_size 4) or greyscale (pixel_size 1) pixels to a BMP
+	row of bpp bits per pixel: BGR for 24 BPP, BGRX for 32 BPP,
+	little-endian 565 or 555 words for 16 BPP, palette indices
+	for 8 BPP. The row padding is zeroed.
+**************************************************************/
+void EncodeRow( u8* dst, const u8* src, u32 width, u32 pixel_size, USHORT bpp, u32 flags, u32 y )
+{
+	u32 i, size = BMP_ROW_STRIDE( width, bpp );
+	u8 *start = dst;
+
+	if ( bpp == 16 )
+	{
+		/* Each channel is quantized to floor( c * max / 255 + t / 32 ), t being 16 (rounding) or
+		an odd ordered dither threshold, which never exceeds max. The division by a constant
+		keeps the loop branch-free so that compilers vectorize it */
+		u32 g_bits = ( flags & BMP_ENCODE_555 ) ? 5 : 6, g_max = ( 1 << g_bits ) - 1;
+		u32 g_off = ( pixel_size == 4 ) ? 1 : 0, b_off = ( pixel_size == 4 ) ? 2 : 0;
+		u32 th[ 4 ], t, r, g, b, v;
+
+		for ( i = 0; i < 4; i++ )
+			th[ i ] = 255 * ( ( flags & BMP_ENCODE_DITHER ) ? 2 * Bayer4[ y & 3 ][ i ] + 1 : 16 );
+
+		for ( i = 0; i < width; i++, src += pixel_size, dst += 2 )
+		{
+			t = th[ i & 3 ];
+			r = ( src[ 0 ] * 31 * 32 + t ) / ( 255 * 32 );
+			g = ( src[ g_off ] * g_max * 32 + t ) / ( 255 * 32 );
+			b = ( src[ b_off ] * 31 * 32 + t ) / ( 255 * 32 );
+			v = ( r << ( 5 + g_bits ) ) | ( g << 5 ) | b;
+			dst[ 0 ] = (u8) v;
+			dst[ 1 ] = (u8) ( v >> 8 );
+		}
+	}
+	else if ( bpp == 8 )
+	{
+		/* Color pixels are stored as their BT.601 luma */
+		if ( pixel_size == 1 )
+		{
+			memcpy( dst, src, width );
+			dst += width;
+		}
+		else for ( i = 0; i < width; i++, src += 4 )
+			*dst++ = (u8) ( ( 77 * src[ 0 ] + 150 * src[ 1 ] + 29 * src[ 2 ] + 128 ) >> 8 );
+	}
+	else if ( pixel_size == 1 )
+	{
+		for ( i = 0; i < width; i++, src++ )
+		{
+			*dst++ = *src;
+			*dst++ = *src;
+			*dst++ = *src;
+			if ( bpp == 32 ) *dst++ = 0xFF;
+		}
+	}
+	else
+	{
+		for ( i = 0; i < width; i++, src += 4 )
+		{
+			*dst++ = src[ 2 ];
+			*dst++ = src[ 1 ];
+			*dst++ = src[ 0 ];
+			if ( bpp == 32 ) *dst++ = src[ 3 ];
+		}
+	}
+	memset( dst, 0, size - ( dst - start ) );
+}
+
+
+/**************************************************************
+	Returns a 64 bit hash of a block of bytes, for change
+	detection. Reads 8 bytes at a time.
+**************************************************************/
+u64 RowHash( const u8* data, u32 size )
+{
+	u64 h = 0x9E3779B97F4A7C15ULL ^ size, w;
+	u32 i;
+
+	for ( i = 0; i + 8 <= size; i += 8 )
+	{
+		memcpy( &w, data + i, 8 );
+		h = ( h ^ w ) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+	}
+	for ( w = 0; i < size; i++ )
+		w = ( w << 8 ) | data[ i ];
+	h = ( h ^ w ) * 0xC4CEB9FE1A85EC53ULL;
+	return h ^ ( h >> 29 );
+}
+
+
+/* Slot of an RGBX color, from the top bits of a multiplicative hash */
+#define BMP_COLOR_HASH( c )	( ( (u32) ( c ) * 0x9E3779B1u ) >> 23 )
+
+
+/**************************************************************
+	Empties a color table.
+**************************************************************/
+void ColorTableReset( QDBMPColorTable* t )
+{
+	memset( t->slots, 0, sizeof( t->slots ) );
+	t->nb_colors = 0;
+}
+
+
+/**************************************************************
+	Adds the colors of an RGBX row to the table. Returns GF_FALSE
+	as soon as the frame has more than 256 colors, in which case
+	the table must not be used for indexing. Runs of a color
+	are looked up once.
+**************************************************************/
+Bool CountColorsRow( QDBMPColorTable* t, const u8* row, u32 width )
+{
+	u32 i, c, h, prev = 0;
+	u16 slot;
+
+	for ( i = 0; i < width; i++ )
+	{
+		memcpy( &c, row + 4 * i, 4 );
+		if ( i && c == prev ) continue;
+		prev = c;
+
+		for ( h = BMP_COLOR_HASH( c ); ( slot = t->slots[ h ] ) != 0; h = ( h + 1 ) & ( BMP_COLOR_SLOTS - 1 ) )
+		{
+			if ( t->colors[ slot - 1 ] == c ) break;
+		}
+		if ( slot ) continue;
+
+		if ( t->nb_colors == 256 )
+			return GF_FALSE;
+		t->colors[ t->nb_colors++ ] = c;
+		t->slots[ h ] = (u16) t->nb_colors;
+	}
+	return GF_TRUE;
+}
+
+
+/**************************************************************
+	Converts an RGBX row to palette indices of bits (8 or 4)
+	bits, 4 bit indices being packed high nibble first. Every
+	color must be in the table. dst may start at row, as each
+	index is stored after its pixel is read.
+**************************************************************/
+void IndexRow( u8* dst, const u8* row, u32 width, const QDBMPColorTable* t, u32 bits )
+{
+	u32 i, c, h, prev = 0, index = 0;
+	u16 slot;
+
+	for ( i = 0; i < width; i++ )
+	{
+		memcpy( &c, row + 4 * i, 4 );
+		if ( !i || c != prev )
+		{
+			for ( h = BMP_COLOR_HASH( c ); ( slot = t->slots[ h ] ) != 0; h = ( h + 1 ) & ( BMP_COLOR_SLOTS - 1 ) )
+			{
+				if ( t->colors[ slot - 1 ] == c ) break;
+			}
+			index = slot ? slot - 1u : 0;
+			prev = c;
+		}
+
+		if ( bits == 8 )
+			dst[ i ] = (u8) index;
+		else if ( i & 1 )
+			dst[ i / 2 ] |= (u8) index;
+		else
+			dst[ i / 2 ] = (u8) ( index << 4 );
+	}
+}
+
+/**************************************************************
+	Converts a BMP row to greyscale according to the channel and
+	grey options. lut maps palette entries for indexed images.
+**************************************************************/
+void GreyRow( u8* dst, const u8* src, u32 width, USHORT bpp, const u8* lut, u32 channel, u32 grey )
+{
+	if ( bpp <= 8 )
+		LookupRow( dst, src, width, bpp, lut );
+	else if ( channel )
+		ExtractChannelRow( dst, src, width, bpp, BMP_CHANNEL_OFFSET[ channel ] );
+	else
+		LumaRow( dst, src, width, bpp, BMP_LUMA_WEIGHTS[ grey ? grey : 1 ] );
+}
+
+
+
+/**************************************************************
+	Resets the QOI state and writes the image header. Returns the
+	write position after the header.
+**************************************************************/
+u8* QOIStart( QOIState* s, u8* out, u32 width, u32 height, u8 channels )
+{
+	memset( s->index, 0, sizeof( s->index ) );
+	s->prev[ 0 ] = s->prev[ 1 ] = s->prev[ 2 ] = 0;
+	s->prev[ 3 ] = 0xFF;
+	s->run = 0;
+
+	memcpy( out, "qoif", 4 );
+	out[ 4 ] = (u8) ( width >> 24 );
+	out[ 5 ] = (u8) ( width >> 16 );
+	out[ 6 ] = (u8) ( width >> 8 );
+	out[ 7 ] = (u8) width;
+	out[ 8 ] = (u8) ( height >> 24 );
+	out[ 9 ] = (u8) ( height >> 16 );
+	out[ 10 ] = (u8) ( height >> 8 );
+	out[ 11 ] = (u8) height;
+	out[ 12 ] = channels;
+	out[ 13 ] = 0;	/* sRGB with linear alpha */
+
+	return out + QOI_HEADER_SIZE;
+}
+
+
+/**************************************************************
+	Encodes a row of RGBA pixels, runs may continue on the next
+	row. Returns the write position after the row.
+**************************************************************/
+u8* QOIEncodeRow( QOIState* s, u8* out, const u8* px, u32 width )
+{
+	u32 i, h;
+
+	for ( i = 0; i < width; i++, px += 4 )
+	{
+		if ( !memcmp( px, s->prev, 4 ) )
+		{
+			if ( ++s->run == QOI_MAX_RUN )
+			{
+				*out++ = QOI_OP_RUN | ( s->run - 1 );
+				s->run = 0;
+			}
+			continue;
+		}
+
+		if ( s->run )
+		{
+			*out++ = QOI_OP_RUN | ( s->run - 1 );
+			s->run = 0;
+		}
+
+		h = QOI_HASH( px ) * 4;
+		if ( !memcmp( s->index + h, px, 4 ) )
+		{
+			*out++ = QOI_OP_INDEX | ( h / 4 );
+		}
+		else
+		{
+			memcpy( s->index + h, px, 4 );
+
+			if ( px[ 3 ] == s->prev[ 3 ] )
+			{
+				s8 vr = (s8) ( px[ 0 ] - s->prev[ 0 ] );
+				s8 vg = (s8) ( px[ 1 ] - s->prev[ 1 ] );
+				s8 vb = (s8) ( px[ 2 ] - s->prev[ 2 ] );
+				s8 vg_r = vr - vg;
+				s8 vg_b = vb - vg;
+
+				if ( vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2 )
+				{
+					*out++ = QOI_OP_DIFF | ( vr + 2 ) << 4 | ( vg + 2 ) << 2 | ( vb + 2 );
+				}
+				else if ( vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8 )
+				{
+					*out++ = QOI_OP_LUMA | ( vg + 32 );
+					*out++ = ( vg_r + 8 ) << 4 | ( vg_b + 8 );
+				}
+				else
+				{
+					*out++ = QOI_OP_RGB;
+					*out++ = px[ 0 ];
+					*out++ = px[ 1 ];
+					*out++ = px[ 2 ];
+				}
+			}
+			else
+			{
+				*out++ = QOI_OP_RGBA;
+				memcpy( out, px, 4 );
+				out += 4;
+			}
+		}
+		memcpy( s->prev, px, 4 );
+	}
+	return out;
+}
+
+
+/**************************************************************
+	Flushes the pending run and writes the end marker. Returns
+	the write position after the marker.
+**************************************************************/
+u8* QOIFinish( QOIState* s, u8* out )
+{
+	if ( s->run )
+		*out++ = QOI_OP_RUN | ( s->run - 1 );
+	memset( out, 0, QOI_END_SIZE - 1 );
+	out[ QOI_END_SIZE - 1 ] = 1;
+	return out + QOI_END_SIZE;
+}
+
+
+/**************************************************************
+	Resets the QOI state to decode an image from the first chunk
+	after the header.
+**************************************************************/
+void QOIDecodeStart( QOIState* s )
+{
+	memset( s->index, 0, sizeof( s->index ) );
+	s->prev[ 0 ] = s->prev[ 1 ] = s->prev[ 2 ] = 0;
+	s->prev[ 3 ] = 0xFF;
+	s->run = 0;
+	s->pos = QOI_HEADER_SIZE;
+}
+
+
+/**************************************************************
+	Decodes the next width pixels of a QOI image into RGBA
+	pixels, so that images can be decoded a row at a time.
+	Returns non-zero on success.
+**************************************************************/
+int QOIDecodeRow( QOIState* s, u8* dst, u32 width, const u8* in, u32 size )
+{
+	u32 p = s->pos;
+	u32 i;
+	u8 *px = s->prev;
+
+	for ( i = 0; i < width; i++, dst += 4 )
+	{
+		if ( s->run )
+		{
+			s->run--;
+		}
+		else
+		{
+			u8 b1;
+
+			if ( p >= size ) return 0;
+			b1 = in[ p++ ];
+
+			if ( b1 == QOI_OP_RGB )
+			{
+				if ( size - p < 3 ) return 0;
+				memcpy( px, in + p, 3 );
+				p += 3;
+			}
+			else if ( b1 == QOI_OP_RGBA )
+			{
+				if ( size - p < 4 ) return 0;
+				memcpy( px, in + p, 4 );
+				p += 4;
+			}
+			else if ( ( b1 & QOI_MASK_2 ) == QOI_OP_INDEX )
+			{
+				memcpy( px, s->index + 4 * b1, 4 );
+			}
+			else if ( ( b1 & QOI_MASK_2 ) == QOI_OP_DIFF )
+			{
+				px[ 0 ] += ( ( b1 >> 4 ) & 0x03 ) - 2;
+				px[ 1 ] += ( ( b1 >> 2 ) & 0x03 ) - 2;
+				px[ 2 ] += ( b1 & 0x03 ) - 2;
+			}
+			else if ( ( b1 & QOI_MASK_2 ) == QOI_OP_LUMA )
+			{
+				u8 b2;
+				if ( p >= size ) return 0;
+				b2 = in[ p++ ];
+				s32 vg = ( b1 & 0x3F ) - 32;
+				px[ 0 ] += vg - 8 + ( ( b2 >> 4 ) & 0x0F );
+				px[ 1 ] += vg;
+				px[ 2 ] += vg - 8 + ( b2 & 0x0F );
+			}
+			else
+			{
+				s->run = b1 & 0x3F;
+			}
+			memcpy( s->index + QOI_HASH( px ) * 4, px, 4 );
+		}
+		memcpy( dst, px, 4 );
+	}
+	s->pos = p;
+	return 1;
+}
+
+/**************************************************************
+	Reads a numeric tar header field: octal digits padded with
+	spaces or NULs, or big-endian base-256 when the high bit of
+	the first byte is set (GNU extension for large values).
+**************************************************************/
+static u64 TarNumber( const u8* field, u32 len )
+{
+	u64 v = 0;
+	u32 i = 0;
+
+	if ( field[ 0 ] & 0x80 )
+	{
+		v = field[ 0 ] & 0x7F;
+		for ( i = 1; i < len; i++ )
+			v = ( v << 8 ) | field[ i ];
+		return v;
+	}
+	while ( i < len && ( field[ i ] == ' ' || field[ i ] == 0 ) ) i++;
+	for ( ; i < len && field[ i ] >= '0' && field[ i ] <= '7'; i++ )
+		v = ( v << 3 ) | ( field[ i ] - '0' );
+	return v;
+}
+
+
+/**************************************************************
+	Checks the checksum of a header block. The checksum is the
+	sum of the header bytes, with the checksum field counted as
+	spaces.
+**************************************************************/
+static Bool TarChecksum( const u8* h )
+{
+	u32 i, sum = 8 * ' ';
+
+	for ( i = 0; i < TAR_BLOCK_SIZE; i++ )
+	{
+		if ( i < 148 || i >= 156 ) sum += h[ i ];
+	}
+	return ( sum == TarNumber( h + 148, 8 ) ) ? GF_TRUE : GF_FALSE;
+}
+
+
+/* Length of a NUL padded header field */
+static u32 TarFieldLength( const u8* field, u32 len )
+{
+	const u8 *end = memchr( field, 0, len );
+	return end ? (u32) ( end - field ) : len;
+}
+
+
+/**************************************************************
+	Returns GF_TRUE if the data starts with a ustar or GNU tar
+	header.
+**************************************************************/
+Bool IsTarArchive( const u8* data, u64 size )
+{
+	if ( size < TAR_BLOCK_SIZE || memcmp( data + 257, "ustar", 5 ) )
+		return GF_FALSE;
+	return TarChecksum( data );
+}
+
+
+/**************************************************************
+	Walks the headers of a tar archive from *pos to the next
+	regular file member, stepping over directories, links and
+	the GNU long name and pax extended headers that apply to
+	the member. The member path is copied to name, if not NULL,
+	truncated to max - 1 characters.
+	Returns 1 when a member is found, 0 at the end of the
+	archive and -1 on corrupted headers.
+**************************************************************/
+static int TarWalk( const u8* data, u64 size, u64* pos, TarMember* m, char* name, u32 max )
+{
+	const u8 *h, *rec, *end, *key, *val_end;
+	u64 start = *pos, fsize, pax_size = 0, rec_len;
+	const u8 *long_name = NULL, *pax_path = NULL;
+	u32 long_len = 0, pax_len = 0, prefix_len, name_len, i;
+	s64 pax_mtime = -1;
+	u32 pax_ns = 0;
+	Bool has_pax_size = GF_FALSE;
+
+	while ( 1 )
+	{
+		if ( *pos > size || size - *pos < TAR_BLOCK_SIZE )
+			return ( *pos >= size ) ? 0 : -1;
+		h = data + *pos;
+
+		/* The archive ends with zero blocks */
+		for ( i = 0; i < TAR_BLOCK_SIZE && !h[ i ]; i++ );
+		if ( i == TAR_BLOCK_SIZE )
+			return 0;
+		if ( !TarChecksum( h ) )
+			return -1;
+
+		fsize = TarNumber( h + 124, 12 );
+		if ( fsize > size - *pos - TAR_BLOCK_SIZE )
+			return -1;
+
+		switch ( h[ 156 ] )
+		{
+		case 'L':
+			/* GNU long name of the next member */
+			long_name = h + TAR_BLOCK_SIZE;
+			long_len = (u32) MIN( fsize, 0xFFFFFFFF );
+			while ( long_len && !long_name[ long_len - 1 ] ) long_len--;
+			break;
+		case 'x':
+			/* pax extended header of the next member, records are "<length> <key>=<value>\n" */
+			rec = h + TAR_BLOCK_SIZE;
+			end = rec + fsize;
+			while ( rec < end )
+			{
+				for ( rec_len = 0, key = rec; key < end && *key >= '0' && *key <= '9'; key++ )
+					rec_len = rec_len * 10 + ( *key - '0' );
+				if ( key == end || *key != ' ' || rec_len < 2 || rec_len > (u64) ( end - rec ) )
+					break;
+				key++;
+				/* Values end with the newline closing the record */
+				val_end = rec + rec_len - 1;
+				if ( val_end - key > 5 && !memcmp( key, "path=", 5 ) )
+				{
+					pax_path = key + 5;
+					pax_len = (u32) ( val_end - pax_path );
+				}
+				else if ( val_end - key > 5 && !memcmp( key, "size=", 5 ) )
+				{
+					for ( pax_size = 0, key += 5; key < val_end && *key >= '0' && *key <= '9'; key++ )
+						pax_size = pax_size * 10 + ( *key - '0' );
+					has_pax_size = GF_TRUE;
+				}
+				else if ( val_end - key > 6 && !memcmp( key, "mtime=", 6 ) )
+				{
+					for ( pax_mtime = 0, key += 6; key < val_end && *key >= '0' && *key <= '9'; key++ )
+						pax_mtime = pax_mtime * 10 + ( *key - '0' );
+					pax_ns = 0;
+					if ( key < val_end && *key == '.' )
+					{
+						for ( i = 0, key++; i < 9; i++ )
+						{
+							pax_ns *= 10;
+							if ( key < val_end && *key >= '0' && *key <= '9' ) pax_ns += *key++ - '0';
+						}
+					}
+				}
+				rec += rec_len;
+			}
+			break;
+		case 0:
+		case '0':
+		case '7':
+			/* pax sizes allow members over the 8 GB of the ustar size field */
+			if ( has_pax_size )
+			{
+				fsize = pax_size;
+				if ( fsize > size - *pos - TAR_BLOCK_SIZE )
+					return -1;
+			}
+			m->header = start;
+			m->offset = *pos + TAR_BLOCK_SIZE;
+			m->size = fsize;
+			m->mtime = ( pax_mtime >= 0 ) ? pax_mtime : (s64) TarNumber( h + 136, 12 );
+			m->mtime_ns = ( pax_mtime >= 0 ) ? pax_ns : 0;
+			*pos = m->offset + ( ( fsize + TAR_BLOCK_SIZE - 1 ) & ~(u64) ( TAR_BLOCK_SIZE - 1 ) );
+
+			if ( name && max )
+			{
+				if ( pax_path || long_name )
+				{
+					name_len = MIN( pax_path ? pax_len : long_len, max - 1 );
+					memcpy( name, pax_path ? pax_path : long_name, name_len );
+				}
+				else
+				{
+					/* ustar splits long paths between the prefix and name fields */
+					prefix_len = TarFieldLength( h + 345, 155 );
+					name_len = 0;
+					if ( prefix_len && !memcmp( h + 257, "ustar\0", 6 ) )
+					{
+						name_len = MIN( prefix_len, max - 1 );
+						memcpy( name, h + 345, name_len );
+						if ( name_len < max - 1 ) name[ name_len++ ] = '/';
+					}
+					i = MIN( TarFieldLength( h, 100 ), max - 1 - name_len );
+					memcpy( name + name_len, h, i );
+					name_len += i;
+				}
+				name[ name_len ] = 0;
+			}
+			return 1;
+		default:
+			/* Other members and headers reset the pending extended attributes */
+			if ( h[ 156 ] != 'g' )
+			{
+				long_name = pax_path = NULL;
+				pax_mtime = -1;
+				pax_ns = 0;
+				has_pax_size = GF_FALSE;
+			}
+			start = *pos + TAR_BLOCK_SIZE + ( ( fsize + TAR_BLOCK_SIZE - 1 ) & ~(u64) ( TAR_BLOCK_SIZE - 1 ) );
+			break;
+		}
+		*pos += TAR_BLOCK_SIZE + ( ( fsize + TAR_BLOCK_SIZE - 1 ) & ~(u64) ( TAR_BLOCK_SIZE - 1 ) );
+	}
+}
+
+
+/**************************************************************
+	Finds the next regular file member of a tar archive from
+	*pos, which is then moved past the member. Members are
+	returned in archive order.
+	Returns 1 when a member is found, 0 at the end of the
+	archive and -1 on corrupted headers.
+**************************************************************/
+int TarNextMember( const u8* data, u64 size, u64* pos, TarMember* m )
+{
+	return TarWalk( data, size, pos, m, NULL, 0 );
+}
+
+
+/**************************************************************
+	Copies the path of a member found by TarNextMember to name,
+	truncated to max - 1 characters. Paths are not kept in the
+	index, as they are only needed for the few members shown.
+	Returns the length of the path.
+**************************************************************/
+u32 TarMemberName( const u8* data, u64 size, const TarMember* m, char* name, u32 max )
+{
+	TarMember tmp;
+	u64 pos = m->header;
+
+	if ( !max ) return 0;
+	name[ 0 ] = 0;
+	if ( TarWalk( data, size, &pos, &tmp, name, max ) != 1 )
+		return 0;
+	return (u32) strlen( name );
+}
+
+/*********************************** Public methods **********************************/
+
+/**************************************************************
+	Returns the image's width.
+**************************************************************/
+UINT BMP_GetWidth( BMP* bmp )
+{
+	if ( bmp == NULL )
+	{
+		BMP_LAST_ERROR_CODE = BMP_INVALID_ARGUMENT;
+		return -1;
+	}
+
+	BMP_LAST_ERROR_CODE = BMP_OK;
+
+	return ( bmp->Header.Width );
+}
+
+
+/**************************************************************
+	Returns the image's height. Top-down bitmaps store a
+	negative height, the absolute value is returned.
+**************************************************************/
+UINT BMP_GetHeight( BMP* bmp )
+{
+	s32 height;
+
+	if ( bmp == NULL )
+	{
+		BMP_LAST_ERROR_CODE = BMP_INVALID_ARGUMENT;
+		return -1;
+	}
+
+	BMP_LAST_ERROR_CODE = BMP_OK;
+
+	height = (s32) bmp->Header.Height;
+	return ( height < 0 ) ? (UINT) -height : (UINT) height;
+}
+
+
+/**************************************************************
+	Returns the image's color depth (bits per pixel).
+**************************************************************/
+USHORT BMP_GetDepth( BMP* bmp )
+{
+	if ( bmp == NULL )
+	{
+		BMP_LAST_ERROR_CODE = BMP_INVALID_ARGUMENT;
+		return -1;
+	}
+
+	BMP_LAST_ERROR_CODE = BMP_OK;
+
+	return ( bmp->Header.BitsPerPixel );
+}
+
+
+/**************************************************************
+	Returns the last error code.
+**************************************************************/
+BMP_STATUS BMP_GetError()
+{
+	return BMP_LAST_ERROR_CODE;
+}
+
+
+/**************************************************************
+	Returns a description of the last error code.
+**************************************************************/
+const char* BMP_GetErrorDescription()
+{
+	return StatusDescription( BMP_LAST_ERROR_CODE );
+}
+
+
+/**************************************************************
+	Returns a description of an error code. Unlike
+	BMP_GetErrorDescription, this does not depend on the last
+	error, so threads may use it on their own results.
+**************************************************************/
+const char* StatusDescription( BMP_STATUS status )
+{
+	if ( status > 0 && status < BMP_ERROR_NUM )
+	{
+		return BMP_ERROR_STRING[ status ];
+	}
+	else
+	{
+		return NULL;
+	}
+}
@@ -0,0 +1,168 @@
+/*
+**
+** Per-thread performance counters. Each counter is a perf_event_open event of the calling
+** thread, user space only, read with its enabled and running times so that values stay
+** comparable when the kernel multiplexes events. When the cycle counter cannot be opened
+** (virtual machines, perf_event_paranoid, seccomp), the set switches to software events, and
+** software events that cannot be opened either are taken from the thread CPU clock and
+** getrusage, so that instrumented runs always report something.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_perf.h"
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERF_CACHE_MISS( cache ) ( ( cache ) | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) )
+
+static const struct
+{
+	u32 type;
+	u64 config;
+	const char *name;
+} PerfEvents[ 2 ][ PERF_NB_COUNTERS ] =
+{
+	{
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+		{ PERF_TYPE_HW_CACHE, PERF_CACHE_MISS( PERF_COUNT_HW_CACHE_LL ), "LLC-misses" },
+		{ PERF_TYPE_HW_CACHE, PERF_CACHE_MISS( PERF_COUNT_HW_CACHE_DTLB ), "dTLB-misses" },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+	},
+	{
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns" },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations" },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ, "major-faults" },
+	},
+};
+
+
+/* Opens an event counting the calling thread in user space. Returns its descriptor or -1. */
+static int PerfOpenEvent( u32 type, u64 config )
+{
+	struct perf_event_attr attr;
+
+	memset( &attr, 0, sizeof( attr ) );
+	attr.size = sizeof( attr );
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int) syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+
+/**************************************************************
+	Opens the counters of the calling thread: hardware events if
+	the cycle counter can be opened, software events otherwise.
+	The counters only count the thread that opened them.
+**************************************************************/
+void PerfOpen( PerfCounters* pc )
+{
+	u32 i, set;
+
+	for ( set = 0; set < 2; set++ )
+	{
+		pc->software = set ? GF_TRUE : GF_FALSE;
+		for ( i = 0; i < PERF_NB_COUNTERS; i++ )
+			pc->fds[ i ] = PerfOpenEvent( PerfEvents[ set ][ i ].type, PerfEvents[ set ][ i ].config );
+		/* Other missing hardware events (no LLC or dTLB event on some cores) only read as 0 */
+		if ( set || pc->fds[ 0 ] >= 0 )
+			return;
+		PerfClose( pc );
+	}
+}
+
+
+/**************************************************************
+	Closes the counters.
+**************************************************************/
+void PerfClose( PerfCounters* pc )
+{
+	u32 i;
+
+	for ( i = 0; i < PERF_NB_COUNTERS; i++ )
+	{
+		if ( pc->fds[ i ] >= 0 ) close( pc->fds[ i ] );
+		pc->fds[ i ] = -1;
+	}
+}
+
+
+/**************************************************************
+	Reads the current values of the counters, scaled to the time
+	the events were enabled when multiplexed. Must be called by
+	the thread that opened them.
+**************************************************************/
+void PerfRead( const PerfCounters* pc, PerfSample* s )
+{
+	struct rusage ru;
+	struct timespec ts;
+	u64 v[ 3 ];
+	u32 i;
+	Bool usage = GF_FALSE;
+
+	for ( i = 0; i < PERF_NB_COUNTERS; i++ )
+	{
+		s->values[ i ] = 0;
+		if ( pc->fds[ i ] >= 0 )
+		{
+			if ( read( pc->fds[ i ], v, sizeof( v ) ) == sizeof( v ) && v[ 2 ] )
+				s->values[ i ] = ( v[ 2 ] < v[ 1 ] ) ? (u64) ( (double) v[ 0 ] * v[ 1 ] / v[ 2 ] ) : v[ 0 ];
+		}
+		else if ( pc->software )
+		{
+			usage = GF_TRUE;
+		}
+	}
+	if ( !usage || getrusage( RUSAGE_THREAD, &ru ) )
+		return;
+
+	/* Software events that could not be opened, CPU migrations are not available */
+	if ( pc->fds[ 0 ] < 0 && !clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) )
+		s->values[ 0 ] = (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if ( pc->fds[ 1 ] < 0 )
+		s->values[ 1 ] = ru.ru_nvcsw + ru.ru_nivcsw;
+	if ( pc->fds[ 3 ] < 0 )
+		s->values[ 3 ] = ru.ru_minflt + ru.ru_majflt;
+	if ( pc->fds[ 4 ] < 0 )
+		s->values[ 4 ] = ru.ru_majflt;
+}
+
+
+/**************************************************************
+	Adds the difference between two readings to total, or the
+	values of end if start is NULL.
+**************************************************************/
+void PerfAdd( PerfSample* total, const PerfSample* start, const PerfSample* end )
+{
+	u32 i;
+
+	for ( i = 0; i < PERF_NB_COUNTERS; i++ )
+		total->values[ i ] += end->values[ i ] - ( start ? start->values[ i ] : 0 );
+}
+
+
+/* Returns the name of a counter of the hardware or software set */
+const char* PerfCounterName( Bool software, u32 counter )
+{
+	return ( counter < PERF_NB_COUNTERS ) ? PerfEvents[ software ? 1 : 0 ][ counter ].name : NULL;
+}
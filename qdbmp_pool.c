@@ -0,0 +1,310 @@
+/*
+**
+** Process-wide thread pool. A single set of worker threads, sized to the core count or to the
+** count given to PoolStart, runs the tasks of every group. Runs are queued in a single central
+** queue under one lock, with no per-thread deques: the thread submitting a run claims tasks of its
+** own run, and idle workers claim the next task from the groups with pending tasks in turn,
+** realtime groups first, so that no instance starves the others and the number of threads stays
+** fixed however many instances there are.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_pool.h"
+#include "qdbmp_trace.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/* Run submitted by PoolRun, kept on the stack of the submitting thread until complete */
+typedef struct _PoolJob
+{
+	struct _PoolJob *next;
+	PoolGroup *group;
+	PoolTask task;
+	void *arg;
+	/* Tasks in the run, claimed by a thread and completed */
+	u32 count, claimed, done;
+} PoolJob;
+
+struct _PoolGroup
+{
+	/* Neighbours in the ring of groups with unclaimed tasks, NULL when out of it */
+	PoolGroup *prev, *next;
+	/* Runs with unclaimed tasks, in submission order */
+	PoolJob *first, *last;
+	Bool realtime;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	/* Signalled when tasks are queued and when runs complete */
+	pthread_cond_t work, done;
+	pthread_t *threads;
+	u32 nb_threads;
+	/* Rings of the realtime and other groups with unclaimed tasks, the heads are served next */
+	PoolGroup *ring[ 2 ];
+	Bool stop;
+} Pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, { NULL, NULL }, GF_FALSE };
+
+/* Index of the pool thread plus one, 0 for other threads */
+static __thread u32 PoolThread;
+
+
+/**************************************************************
+	Adds a group at the back of its ring, or removes it.
+	Called with the lock held.
+**************************************************************/
+static void PoolRingAdd( PoolGroup* g )
+{
+	PoolGroup **head = &Pool.ring[ g->realtime ? 0 : 1 ];
+
+	if ( !*head )
+	{
+		g->prev = g->next = g;
+		*head = g;
+		return;
+	}
+	g->next = *head;
+	g->prev = ( *head )->prev;
+	g->prev->next = g;
+	( *head )->prev = g;
+}
+
+static void PoolRingRemove( PoolGroup* g )
+{
+	PoolGroup **head = &Pool.ring[ g->realtime ? 0 : 1 ];
+
+	if ( g->next == g )
+	{
+		*head = NULL;
+	}
+	else
+	{
+		g->prev->next = g->next;
+		g->next->prev = g->prev;
+		if ( *head == g ) *head = g->next;
+	}
+	g->prev = g->next = NULL;
+}
+
+
+/**************************************************************
+	Claims the next task of job or, if job is NULL, of the first
+	run of the group at the head of the rings, realtime groups
+	first; that group then moves to the back so that groups are
+	served in turn. Runs leave their group once fully claimed.
+	Called with the lock held. Returns the run of the claimed
+	task, or NULL if there is none.
+**************************************************************/
+static PoolJob* PoolClaim( PoolJob* job, u32* index )
+{
+	PoolGroup *g;
+	PoolJob *prev, *j;
+
+	if ( !job )
+	{
+		g = Pool.ring[ 0 ] ? Pool.ring[ 0 ] : Pool.ring[ 1 ];
+		if ( !g ) return NULL;
+		Pool.ring[ g->realtime ? 0 : 1 ] = g->next;
+		job = g->first;
+	}
+	else if ( job->claimed == job->count )
+	{
+		return NULL;
+	}
+
+	*index = job->claimed++;
+	if ( job->claimed == job->count )
+	{
+		g = job->group;
+		for ( prev = NULL, j = g->first; j != job; j = j->next )
+			prev = j;
+		if ( prev ) prev->next = job->next;
+		else g->first = job->next;
+		if ( g->last == job ) g->last = prev;
+		if ( !g->first )
+			PoolRingRemove( g );
+	}
+	return job;
+}
+
+
+/* Pool thread: runs the tasks of all groups until the pool stops */
+static void* PoolWorker( void* arg )
+{
+	PoolJob *job;
+	u32 index;
+	u64 start;
+
+	PoolThread = (u32) (uintptr_t) arg + 1;
+	TraceThreadName( "pool", (s32) PoolThread - 1 );
+	pthread_mutex_lock( &Pool.lock );
+	while ( !Pool.stop )
+	{
+		job = PoolClaim( NULL, &index );
+		if ( !job )
+		{
+			/* Idle spans show the bubbles between runs */
+			start = TraceEnabled ? TraceNow() : 0;
+			pthread_cond_wait( &Pool.work, &Pool.lock );
+			if ( TraceEnabled ) TraceSpan( "idle", NULL, start, TraceNow() );
+			continue;
+		}
+		pthread_mutex_unlock( &Pool.lock );
+		job->task( job->arg, index, PoolThread - 1 );
+		pthread_mutex_lock( &Pool.lock );
+		if ( ++job->done == job->count )
+			pthread_cond_broadcast( &Pool.done );
+	}
+	pthread_mutex_unlock( &Pool.lock );
+	return NULL;
+}
+
+
+/**************************************************************
+	Starts the process-wide pool with nb_threads threads, the
+	number of cores if 0. The pool is started once, by the first
+	call or the first group created; later calls keep it as is.
+	Returns the number of pool threads.
+**************************************************************/
+u32 PoolStart( u32 nb_threads )
+{
+	pthread_mutex_lock( &Pool.lock );
+	if ( !Pool.threads )
+	{
+		if ( !nb_threads )
+			nb_threads = (u32) MAX( 1, sysconf( _SC_NPROCESSORS_ONLN ) );
+		Pool.threads = calloc( nb_threads, sizeof( pthread_t ) );
+		/* Threads that fail to start are simply missing, runs complete on the submitting thread */
+		for ( Pool.nb_threads = 0; Pool.threads && Pool.nb_threads < nb_threads; Pool.nb_threads++ )
+		{
+			if ( pthread_create( &Pool.threads[ Pool.nb_threads ], NULL, PoolWorker, (void*) (uintptr_t) Pool.nb_threads ) )
+				break;
+		}
+	}
+	nb_threads = Pool.nb_threads;
+	pthread_mutex_unlock( &Pool.lock );
+	return nb_threads;
+}
+
+
+/* Returns the number of pool threads, 0 until the pool is started */
+u32 PoolSize( void )
+{
+	return Pool.nb_threads;
+}
+
+
+/**************************************************************
+	Stops and joins the pool threads, once no run is pending.
+	The pool can be started again.
+**************************************************************/
+void PoolStop( void )
+{
+	u32 i;
+
+	pthread_mutex_lock( &Pool.lock );
+	Pool.stop = GF_TRUE;
+	pthread_cond_broadcast( &Pool.work );
+	pthread_mutex_unlock( &Pool.lock );
+
+	for ( i = 0; i < Pool.nb_threads; i++ )
+		pthread_join( Pool.threads[ i ], NULL );
+	free( Pool.threads );
+	Pool.threads = NULL;
+	Pool.nb_threads = 0;
+	Pool.stop = GF_FALSE;
+}
+
+
+/**************************************************************
+	Creates a group of runs, starting the pool with one thread
+	per core if needed. Realtime groups are served before the
+	others. Returns NULL on error.
+**************************************************************/
+PoolGroup* PoolGroupNew( Bool realtime )
+{
+	PoolGroup *g = calloc( 1, sizeof( PoolGroup ) );
+
+	if ( !g ) return NULL;
+	g->realtime = realtime;
+	PoolStart( 0 );
+	return g;
+}
+
+
+/* Frees a group, which must have no pending run */
+void PoolGroupDel( PoolGroup* g )
+{
+	free( g );
+}
+
+
+/**************************************************************
+	Runs task for indices 0 to count - 1 and returns once they
+	have all completed. Rather than blocking, the calling thread
+	claims tasks of its own run along with the pool threads, so
+	runs can be submitted from within tasks. Without group or pool threads,
+	the tasks run in order on the calling thread.
+**************************************************************/
+void PoolRun( PoolGroup* g, PoolTask task, void* arg, u32 count )
+{
+	u32 index, thread = PoolThread ? PoolThread - 1 : Pool.nb_threads;
+	PoolJob job;
+	u64 start;
+
+	if ( !g || !Pool.nb_threads || count < 2 )
+	{
+		for ( index = 0; index < count; index++ )
+			task( arg, index, thread );
+		return;
+	}
+
+	job.next = NULL;
+	job.group = g;
+	job.task = task;
+	job.arg = arg;
+	job.count = count;
+	job.claimed = job.done = 0;
+
+	pthread_mutex_lock( &Pool.lock );
+	if ( g->first )
+	{
+		g->last->next = &job;
+	}
+	else
+	{
+		g->first = &job;
+		PoolRingAdd( g );
+	}
+	g->last = &job;
+	pthread_cond_broadcast( &Pool.work );
+
+	while ( PoolClaim( &job, &index ) )
+	{
+		pthread_mutex_unlock( &Pool.lock );
+		task( arg, index, thread );
+		pthread_mutex_lock( &Pool.lock );
+		job.done++;
+	}
+	/* Waits for the tasks stolen by pool threads */
+	start = ( TraceEnabled && job.done < job.count ) ? TraceNow() : 0;
+	while ( job.done < job.count )
+		pthread_cond_wait( &Pool.done, &Pool.lock );
+	pthread_mutex_unlock( &Pool.lock );
+	if ( start ) TraceSpan( "join", NULL, start, TraceNow() );
+}
@@ -0,0 +1,212 @@
+/*
+**
+** Offline trace recorder. Every thread appends its spans to a buffer of its own, without
+** locking; buffers are pushed once onto a global list with a compare-and-swap when a thread
+** records its first span, and are only read by TraceWrite, once the traced threads are done.
+** Span names and details are stored as pointers and must stay valid until TraceWrite.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+	const char *name, *detail;
+	/* Nanoseconds since TraceStart */
+	u64 start, end;
+} TraceEvent;
+
+/* Spans of a thread */
+typedef struct _TraceBuffer
+{
+	struct _TraceBuffer *next;
+	u32 tid;
+	char name[ 32 ];
+	TraceEvent *events;
+	u32 nb_events, alloc_events;
+	/* Spans lost when the buffer could not grow */
+	u32 nb_dropped;
+} TraceBuffer;
+
+Bool TraceEnabled = GF_FALSE;
+
+static u64 TraceOrigin;
+static TraceBuffer *TraceBuffers;
+static __thread TraceBuffer *TraceLocal;
+
+
+/* Returns the buffer of the calling thread, registering it on first use, or NULL on error */
+static TraceBuffer* TraceGetBuffer( void )
+{
+	TraceBuffer *b = TraceLocal;
+
+	if ( b ) return b;
+	b = calloc( 1, sizeof( TraceBuffer ) );
+	if ( !b ) return NULL;
+	b->tid = (u32) syscall( SYS_gettid );
+	b->next = __atomic_load_n( &TraceBuffers, __ATOMIC_RELAXED );
+	while ( !__atomic_compare_exchange_n( &TraceBuffers, &b->next, b, GF_TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+		;
+	TraceLocal = b;
+	return b;
+}
+
+
+/**************************************************************
+	Starts recording, with timestamps relative to now.
+	Called before the traced threads start.
+**************************************************************/
+void TraceStart( void )
+{
+	TraceEnabled = GF_FALSE;
+	TraceOrigin = TraceNow();
+	TraceEnabled = GF_TRUE;
+}
+
+
+/* Returns the monotonic clock in nanoseconds since TraceStart */
+u64 TraceNow( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec - TraceOrigin;
+}
+
+
+/**************************************************************
+	Names the calling thread in the trace, followed by index if
+	not negative.
+**************************************************************/
+void TraceThreadName( const char* name, s32 index )
+{
+	TraceBuffer *b;
+
+	if ( !TraceEnabled || !( b = TraceGetBuffer() ) ) return;
+	if ( index >= 0 )
+		snprintf( b->name, sizeof( b->name ), "%s %d", name, index );
+	else
+		snprintf( b->name, sizeof( b->name ), "%s", name );
+}
+
+
+/**************************************************************
+	Records a span of the calling thread between two TraceNow
+	readings. detail, shown as an argument of the span, may be
+	NULL.
+**************************************************************/
+void TraceSpan( const char* name, const char* detail, u64 start, u64 end )
+{
+	TraceBuffer *b;
+	TraceEvent *e;
+
+	if ( !TraceEnabled || !( b = TraceGetBuffer() ) ) return;
+	if ( b->nb_events == b->alloc_events )
+	{
+		u32 alloc = b->alloc_events ? 2 * b->alloc_events : 1024;
+		TraceEvent *events = realloc( b->events, alloc * sizeof( TraceEvent ) );
+		if ( !events )
+		{
+			b->nb_dropped++;
+			return;
+		}
+		b->events = events;
+		b->alloc_events = alloc;
+	}
+	e = &b->events[ b->nb_events++ ];
+	e->name = name;
+	e->detail = detail;
+	e->start = start;
+	e->end = end;
+}
+
+
+/* Writes a JSON string */
+static void TraceWriteString( FILE* f, const char* s )
+{
+	fputc( '"', f );
+	for ( ; *s; s++ )
+	{
+		if ( *s == '"' || *s == '\\' ) fprintf( f, "\\%c", *s );
+		else if ( (u8) *s < 0x20 ) fprintf( f, "\\u%04x", (u8) *s );
+		else fputc( *s, f );
+	}
+	fputc( '"', f );
+}
+
+
+/**************************************************************
+	Stops recording and writes the spans of all threads as a
+	Chrome trace-event file, then frees them. Must be called
+	once the other traced threads have exited. Returns GF_TRUE
+	on success.
+**************************************************************/
+Bool TraceWrite( const char* path )
+{
+	TraceBuffer *b, *next;
+	TraceEvent *e;
+	u32 i, pid = (u32) getpid();
+	Bool first = GF_TRUE, ok;
+	FILE *f;
+
+	TraceEnabled = GF_FALSE;
+	f = fopen( path, "w" );
+	if ( f )
+		fprintf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+
+	for ( b = TraceBuffers; b; b = next )
+	{
+		next = b->next;
+		if ( f && b->name[ 0 ] )
+		{
+			fprintf( f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",", pid, b->tid );
+			TraceWriteString( f, b->name );
+			fprintf( f, "}}" );
+			first = GF_FALSE;
+		}
+		for ( i = 0; f && i < b->nb_events; i++ )
+		{
+			e = &b->events[ i ];
+			fprintf( f, "%s\n{\"name\":", first ? "" : "," );
+			TraceWriteString( f, e->name );
+			fprintf( f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u", e->start / 1e3, ( e->end - e->start ) / 1e3, pid, b->tid );
+			if ( e->detail )
+			{
+				fprintf( f, ",\"args\":{\"detail\":" );
+				TraceWriteString( f, e->detail );
+				fputc( '}', f );
+			}
+			fputc( '}', f );
+			first = GF_FALSE;
+		}
+		if ( b->nb_dropped )
+			fprintf( stderr, "%s: %u spans of thread %u dropped\n", path, b->nb_dropped, b->tid );
+		free( b->events );
+		free( b );
+	}
+	TraceBuffers = NULL;
+	/* Buffers are freed, threads that record again get new ones */
+	TraceLocal = NULL;
+
+	if ( !f ) return GF_FALSE;
+	fprintf( f, "\n]}\n" );
+	ok = !ferror( f );
+	if ( fclose( f ) ) ok = GF_FALSE;
+	return ok;
+}
@@ -0,0 +1,323 @@
+/*
+**
+** Native BMP file writer. Files are kept open across frames and patched in place: when the
+** geometry is unchanged, only the rows whose encoded content changed are written, adjacent
+** changed rows being coalesced into a single positional write. Large frames written whole
+** are encoded in bands by the process-wide thread pool straight into the pre-sized, memory-mapped file.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_writer.h"
+#include "qdbmp_trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Frame encoded into a mapped file, shared by the band tasks */
+typedef struct
+{
+	u8 *rows;
+	const u8 *pixels;
+	u32 width, height, stride, pixel_size, row_size;
+	USHORT bpp;
+	u32 flags;
+	/* Row hashes to fill, or NULL */
+	u64 *hashes;
+} WriterMapJob;
+
+
+/**************************************************************
+	Writes size bytes at offset, retrying short writes.
+	Returns non-zero on success.
+**************************************************************/
+static int WriterPwrite( QDBMPWriter* w, const u8* data, u64 size, u64 offset )
+{
+	ssize_t res;
+
+	while ( size )
+	{
+		res = pwrite( w->fd, data, (size_t) MIN( size, 1u << 30 ), (off_t) offset );
+		if ( res <= 0 ) return 0;
+		data += res;
+		size -= res;
+		offset += res;
+		w->nb_bytes += res;
+		w->nb_writes++;
+	}
+	return 1;
+}
+
+
+/* Band task: encodes a band of rows at its final offset in the mapping */
+static void WriterEncodeBand( void* arg, u32 index, u32 thread )
+{
+	WriterMapJob *job = arg;
+	u32 y = index * WRITER_BAND_ROWS, end = MIN( y + WRITER_BAND_ROWS, job->height );
+	u64 start = TraceEnabled ? TraceNow() : 0;
+	u8 *row;
+
+	(void) thread;
+
+	/* File rows are bottom-up */
+	for ( ; y < end; y++ )
+	{
+		row = job->rows + (u64) y * job->row_size;
+		EncodeRow( row, job->pixels + (u64) ( job->height - 1 - y ) * job->stride, job->width, job->pixel_size, job->bpp, job->flags, job->height - 1 - y );
+		if ( job->hashes )
+			job->hashes[ y ] = RowHash( row, job->row_size );
+	}
+	if ( TraceEnabled ) TraceSpan( "encode band", NULL, start, TraceNow() );
+}
+
+
+/**************************************************************
+	Writes a whole frame through a mapping of the file, sized
+	first with ftruncate. The rows are encoded in bands by runs
+	of pool, on the calling thread if NULL, directly at their
+	final offsets, and the header is stored last so that an
+	interrupted write does not leave a valid looking file. Row
+	hashes are filled if hashes is not NULL. Returns BMP_OK on
+	success.
+**************************************************************/
+static BMP_STATUS WriterEncodeMapped( int fd, const u8* header, u32 header_size, const u8* pixels, u32 width, u32 height, u32 stride, u32 pixel_size, USHORT bpp, u32 flags, u64* hashes, PoolGroup* pool )
+{
+	WriterMapJob job;
+	u64 total;
+	u8 *map;
+
+	job.row_size = BMP_ROW_STRIDE( width, bpp );
+	total = header_size + (u64) job.row_size * height;
+	if ( total != (size_t) total || ftruncate( fd, (off_t) total ) )
+		return BMP_IO_ERROR;
+	map = mmap( NULL, (size_t) total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( map == MAP_FAILED )
+		return BMP_IO_ERROR;
+
+	/* A previous header stays invalid until the new rows are in place */
+	map[ 0 ] = map[ 1 ] = 0;
+
+	job.rows = map + header_size;
+	job.pixels = pixels;
+	job.width = width;
+	job.height = height;
+	job.stride = stride;
+	job.pixel_size = pixel_size;
+	job.bpp = bpp;
+	job.flags = flags;
+	job.hashes = hashes;
+	PoolRun( pool, WriterEncodeBand, &job, ( height + WRITER_BAND_ROWS - 1 ) / WRITER_BAND_ROWS );
+
+	memcpy( map, header, header_size );
+	if ( munmap( map, (size_t) total ) )
+		return BMP_IO_ERROR;
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Hashes the rows of an existing file whose header matches the
+	one of the next frame, so that a writer reopening a file
+	only patches what changed since the file was written.
+	Returns non-zero if the hashes were loaded.
+**************************************************************/
+static int WriterLoad( QDBMPWriter* w, const u8* header, u32 header_size )
+{
+	u8 existing[ BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp ];
+	struct stat st;
+	u32 y, n, i;
+
+	if ( fstat( w->fd, &st ) || (u64) st.st_size != header_size + (u64) w->row_size * w->height )
+		return 0;
+	if ( pread( w->fd, existing, header_size, 0 ) != (ssize_t) header_size || memcmp( existing, header, header_size ) )
+		return 0;
+
+	for ( y = 0; y < w->height; y += n )
+	{
+		n = MIN( WRITER_BAND_ROWS, w->height - y );
+		if ( pread( w->fd, w->band, (size_t) ( (u64) n * w->row_size ), (off_t) ( header_size + (u64) y * w->row_size ) ) != (ssize_t) ( (u64) n * w->row_size ) )
+			return 0;
+		for ( i = 0; i < n; i++ )
+			w->hashes[ y + i ] = RowHash( w->band + (u64) i * w->row_size, w->row_size );
+	}
+	return 1;
+}
+
+
+/**************************************************************
+	Opens or creates a BMP file for writing. An existing file is
+	not truncated, it is patched by the first frame if its
+	geometry matches. Returns NULL on error.
+**************************************************************/
+QDBMPWriter* WriterOpen( const char* path )
+{
+	QDBMPWriter *w = calloc( 1, sizeof( QDBMPWriter ) );
+
+	if ( !w ) return NULL;
+	w->fd = open( path, O_RDWR | O_CREAT, 0644 );
+	if ( w->fd < 0 )
+	{
+		free( w );
+		return NULL;
+	}
+	return w;
+}
+
+
+/**************************************************************
+	Writes a frame of top-down RGBX (pixel_size 4) or greyscale
+	(pixel_size 1) rows as a bpp bits per pixel BMP, flags being
+	BMP_ENCODE_* values. If the header is the one of the previous
+	frame, only the rows whose hash changed are written;
+	otherwise the file is resized and fully rewritten, header
+	included. Returns BMP_OK on success.
+**************************************************************/
+BMP_STATUS WriterUpdate( QDBMPWriter* w, const u8* pixels, u32 width, u32 height, u32 stride, u32 pixel_size, USHORT bpp, u32 flags )
+{
+	u8 header[ BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp ];
+	u32 header_size, row_size, y, run_start = 0, run_len = 0;
+	Bool rewrite;
+	u64 h;
+	u8 *row;
+
+	if ( !w || !pixels || ( pixel_size != 1 && pixel_size != 4 ) )
+		return BMP_INVALID_ARGUMENT;
+	header_size = BuildHeader( header, width, height, bpp, flags );
+	if ( !header_size )
+		return BMP_FILE_NOT_SUPPORTED;
+	row_size = BMP_ROW_STRIDE( width, bpp );
+
+	/* The header holds the geometry and palette, a different header means a new layout */
+	rewrite = ( !w->hashes || header_size != w->header_size || memcmp( header, w->header, header_size ) ) ? GF_TRUE : GF_FALSE;
+	if ( rewrite )
+	{
+		Bool first = w->hashes ? GF_FALSE : GF_TRUE;
+		u64 *hashes = realloc( w->hashes, (u64) height * sizeof( u64 ) );
+		u8 *band = realloc( w->band, (u64) WRITER_BAND_ROWS * row_size );
+
+		if ( hashes ) w->hashes = hashes;
+		if ( band ) w->band = band;
+		if ( !hashes || !band )
+		{
+			free( w->hashes );
+			w->hashes = NULL;
+			return BMP_OUT_OF_MEMORY;
+		}
+		memcpy( w->header, header, header_size );
+		w->header_size = header_size;
+		w->width = width;
+		w->height = height;
+		w->row_size = row_size;
+
+		/* A file left by a previous writer may already hold the layout */
+		if ( first && WriterLoad( w, header, header_size ) )
+			rewrite = GF_FALSE;
+		else if ( w->pool && (u64) row_size * height >= WRITER_PARALLEL_MIN )
+		{
+			/* Large frames are encoded in parallel into the mapped file, without going through the band */
+			BMP_STATUS status = WriterEncodeMapped( w->fd, header, header_size, pixels, width, height, stride, pixel_size, bpp, flags, w->hashes, w->pool );
+			if ( status != BMP_OK )
+			{
+				free( w->hashes );
+				w->hashes = NULL;
+				return status;
+			}
+			w->nb_bytes += header_size + (u64) row_size * height;
+			return BMP_OK;
+		}
+		else if ( ftruncate( w->fd, (off_t) ( header_size + (u64) row_size * height ) ) || !WriterPwrite( w, header, header_size, 0 ) )
+		{
+			free( w->hashes );
+			w->hashes = NULL;
+			return BMP_IO_ERROR;
+		}
+	}
+
+	/* Rows are visited in file order, so that changed neighbours form one contiguous run */
+	for ( y = 0; y <= height; y++ )
+	{
+		if ( y < height )
+		{
+			row = w->band + (u64) run_len * row_size;
+			EncodeRow( row, pixels + (u64) ( height - 1 - y ) * stride, width, pixel_size, bpp, flags, height - 1 - y );
+			h = RowHash( row, row_size );
+			if ( rewrite || h != w->hashes[ y ] )
+			{
+				w->hashes[ y ] = h;
+				if ( !run_len ) run_start = y;
+				if ( ++run_len < WRITER_BAND_ROWS )
+					continue;
+			}
+			else if ( !run_len )
+				continue;
+		}
+		if ( !run_len )
+			continue;
+
+		if ( !WriterPwrite( w, w->band, (u64) run_len * row_size, header_size + (u64) run_start * row_size ) )
+		{
+			/* The file content is unknown, the next frame rewrites it */
+			free( w->hashes );
+			w->hashes = NULL;
+			return BMP_IO_ERROR;
+		}
+		run_len = 0;
+	}
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Writes a frame of top-down RGBX (pixel_size 4) or greyscale
+	(pixel_size 1) rows to a new bpp bits per pixel BMP file,
+	flags being BMP_ENCODE_* values, encoded by runs of pool,
+	on the calling thread if NULL, into the mapped file.
+	Returns BMP_OK on success.
+**************************************************************/
+BMP_STATUS WriteBMPFile( const char* path, const u8* pixels, u32 width, u32 height, u32 stride, u32 pixel_size, USHORT bpp, u32 flags, PoolGroup* pool )
+{
+	u8 header[ BMP_HEADER_SIZE + BMP_PALETTE_SIZE_8bpp ];
+	u32 header_size;
+	BMP_STATUS status;
+	int fd;
+
+	if ( !path || !pixels || ( pixel_size != 1 && pixel_size != 4 ) )
+		return BMP_INVALID_ARGUMENT;
+	header_size = BuildHeader( header, width, height, bpp, flags );
+	if ( !header_size )
+		return BMP_FILE_NOT_SUPPORTED;
+
+	fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		return BMP_IO_ERROR;
+	status = WriterEncodeMapped( fd, header, header_size, pixels, width, height, stride, pixel_size, bpp, flags, NULL, pool );
+	if ( close( fd ) && status == BMP_OK )
+		status = BMP_IO_ERROR;
+	return status;
+}
+
+
+/**************************************************************
+	Closes the file and frees the writer.
+**************************************************************/
+void WriterClose( QDBMPWriter* w )
+{
+	if ( !w ) return;
+	close( w->fd );
+	free( w->hashes );
+	free( w->band );
+	free( w );
+}
@@ -0,0 +1,548 @@
+/*
+**
+** qdbmp-bake: build-time BMP asset baker built on the QDBMP decode kernels.
+**
+** Decodes BMP files into RGBX, greyscale or RGB565 pixels and emits them as a C source file of
+** const arrays, or of a single blob, with an index of the assets and a header declaring them.
+** Baked assets are usable at startup without decoding or heap allocation.
+** The add_baked_assets CMake function in filters.cmake runs it.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_core.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Offsets of the assets of a blob are multiples of this, and so is the alignment of the arrays */
+#define BAKE_ALIGN	16
+
+/* Pixel formats, the value is the pixel size in bytes */
+enum
+{
+	BAKE_GREY = 1,
+	BAKE_RGB565 = 2,
+	BAKE_RGBX = 4,
+};
+
+/* Decoded asset */
+typedef struct
+{
+	const char *path;
+	/* C identifier derived from the file name */
+	char *name;
+	u32 width, height, stride;
+	u8 *pixels;
+	/* Offset in the blob */
+	u64 offset;
+} BakeAsset;
+
+typedef struct
+{
+	//options
+	const char *prefix, *out_c, *out_h;
+	u32 format;
+	Bool dither, blob;
+
+	BakeAsset *assets;
+	u32 nb_assets;
+} BakeCtx;
+
+
+/**************************************************************
+	Reads a whole file. Returns its data, to be freed, or NULL.
+**************************************************************/
+static u8* bake_read( const char* path, u64* size )
+{
+	FILE *f = fopen( path, "rb" );
+	u8 *data = NULL;
+	long len;
+
+	if ( !f ) return NULL;
+	if ( !fseek( f, 0, SEEK_END ) && ( len = ftell( f ) ) > 0 && !fseek( f, 0, SEEK_SET ) )
+	{
+		data = malloc( (size_t) len );
+		if ( data && fread( data, 1, (size_t) len, f ) != (size_t) len )
+		{
+			free( data );
+			data = NULL;
+		}
+		*size = (u64) len;
+	}
+	fclose( f );
+	return data;
+}
+
+
+/**************************************************************
+	Returns the C identifier of an asset: its file name without
+	extension, lowercase, other characters replaced by '_'.
+**************************************************************/
+static char* bake_name( const char* path )
+{
+	const char *base = strrchr( path, '/' ), *dot;
+	char *name;
+	size_t i, len;
+
+	base = base ? base + 1 : path;
+	dot = strrchr( base, '.' );
+	len = dot && dot != base ? (size_t) ( dot - base ) : strlen( base );
+	name = malloc( len + 2 );
+	if ( !name ) return NULL;
+	/* Identifiers cannot start with a digit */
+	i = 0;
+	if ( !len || isdigit( (unsigned char) base[ 0 ] ) ) name[ i++ ] = '_';
+	for ( ; len; len--, base++ )
+		name[ i++ ] = isalnum( (unsigned char) *base ) ? (char) tolower( (unsigned char) *base ) : '_';
+	name[ i ] = 0;
+	return name;
+}
+
+
+/* Generated identifier, and the asset it names or NULL for the index, the blob and the count */
+typedef struct
+{
+	char *id;
+	const BakeAsset *asset;
+} BakeSymbol;
+
+/* Orders symbols on their identifier */
+static int bake_cmp_symbol( const void* a, const void* b )
+{
+	return strcmp( ( (const BakeSymbol*) a )->id, ( (const BakeSymbol*) b )->id );
+}
+
+/* Adds the identifier prefix_name, in uppercase for enum constants. Returns non-zero on success. */
+static int bake_add_symbol( BakeSymbol* sym, const BakeCtx* ctx, const BakeAsset* asset, const char* name, Bool upper )
+{
+	char *c;
+
+	sym->asset = asset;
+	if ( asprintf( &sym->id, "%s_%s", ctx->prefix, name ) < 0 )
+	{
+		sym->id = NULL;
+		return 0;
+	}
+	for ( c = sym->id; upper && *c; c++ )
+		*c = (char) toupper( (unsigned char) *c );
+	return 1;
+}
+
+
+/**************************************************************
+	Checks that the identifiers generated for the assets, their
+	arrays and enum constants, are unique and do not collide with
+	the index, the blob or the asset count, whether or not the
+	blob is written. Returns non-zero on success.
+**************************************************************/
+static int bake_check_symbols( BakeCtx* ctx )
+{
+	u32 i, nb = 0;
+	BakeSymbol *syms = calloc( 3 + 2 * ctx->nb_assets, sizeof( BakeSymbol ) ), *a, *b;
+	char *constant;
+	int ok;
+
+	if ( !syms ) return 0;
+	ok = bake_add_symbol( &syms[ nb++ ], ctx, NULL, "assets", GF_FALSE )
+		&& bake_add_symbol( &syms[ nb++ ], ctx, NULL, "blob", GF_FALSE )
+		&& bake_add_symbol( &syms[ nb++ ], ctx, NULL, "NB_ASSETS", GF_TRUE );
+	for ( i = 0; ok && i < ctx->nb_assets; i++ )
+	{
+		ok = bake_add_symbol( &syms[ nb++ ], ctx, &ctx->assets[ i ], ctx->assets[ i ].name, GF_FALSE );
+		if ( ok && asprintf( &constant, "ASSET_%s", ctx->assets[ i ].name ) >= 0 )
+		{
+			ok = bake_add_symbol( &syms[ nb++ ], ctx, &ctx->assets[ i ], constant, GF_TRUE );
+			free( constant );
+		}
+		else ok = 0;
+	}
+	if ( !ok )
+		fprintf( stderr, "Out of memory\n" );
+	else
+	{
+		qsort( syms, nb, sizeof( BakeSymbol ), bake_cmp_symbol );
+		for ( i = 1; i < nb; i++ )
+		{
+			if ( strcmp( syms[ i - 1 ].id, syms[ i ].id ) ) continue;
+			/* b names an asset, a the other asset or a reserved identifier */
+			a = syms[ i ].asset ? &syms[ i - 1 ] : &syms[ i ];
+			b = syms[ i ].asset ? &syms[ i ] : &syms[ i - 1 ];
+			if ( a->asset )
+				fprintf( stderr, "%s: identifier %s already used by %s\n", b->asset->path, b->id, a->asset->path );
+			else
+				fprintf( stderr, "%s: identifier %s is reserved\n", b->asset->path, b->id );
+			ok = 0;
+		}
+	}
+	for ( i = 0; i < nb; i++ )
+		free( syms[ i ].id );
+	free( syms );
+	return ok;
+}
+
+
+/**************************************************************
+	Decodes a BMP file into packed pixels of the output format,
+	top row first. Returns BMP_OK on success.
+**************************************************************/
+static BMP_STATUS bake_decode( BakeCtx* ctx, BakeAsset* a )
+{
+	QDBMPSource src;
+	u8 *data, *rgbx = NULL, *enc = NULL;
+	u64 size = 0, row_size, out_size;
+	u32 y;
+	BMP_STATUS status;
+
+	data = bake_read( a->path, &size );
+	if ( !data ) return BMP_FILE_NOT_FOUND;
+
+	status = ReadSource( data, size, 0, ( ctx->format == BAKE_GREY ) ? 1 : 0, &src );
+	if ( status == BMP_OK )
+		status = LocateRows( &src, data, size );
+	if ( status != BMP_OK )
+	{
+		free( data );
+		return status;
+	}
+
+	/* The index holds 32-bit strides, and the pixels must fit in memory */
+	row_size = (u64) src.width * ctx->format;
+	out_size = row_size * src.height;
+	if ( row_size > 0xFFFFFFFF || out_size != (size_t) out_size )
+	{
+		free( data );
+		return BMP_OUT_OF_MEMORY;
+	}
+
+	a->width = src.width;
+	a->height = src.height;
+	a->stride = (u32) row_size;
+	a->pixels = malloc( (size_t) MAX( out_size, 1 ) );
+	if ( ctx->format == BAKE_RGB565 )
+	{
+		/* RGB565 goes through RGBX and the 16 BPP encoder, whose rows are padded */
+		rgbx = malloc( (size_t) src.width * 4 );
+		enc = malloc( (size_t) BMP_ROW_STRIDE( (u64) src.width, 16 ) );
+	}
+	if ( !a->pixels || ( ctx->format == BAKE_RGB565 && ( !rgbx || !enc ) ) )
+	{
+		free( data );
+		free( rgbx );
+		free( enc );
+		return BMP_OUT_OF_MEMORY;
+	}
+
+	for ( y = 0; y < src.height; y++ )
+	{
+		u8 *dst = a->pixels + (u64) y * row_size;
+
+		if ( ctx->format == BAKE_GREY )
+			GreyRow( dst, BMP_SOURCE_ROW( &src, y ), src.width, src.bpp, src.grey_lut, 0, 1 );
+		else if ( ctx->format == BAKE_RGBX )
+			ColorRow( dst, BMP_SOURCE_ROW( &src, y ), src.width, src.bpp, src.color_lut );
+		else
+		{
+			ColorRow( rgbx, BMP_SOURCE_ROW( &src, y ), src.width, src.bpp, src.color_lut );
+			EncodeRow( enc, rgbx, src.width, 4, 16, ctx->dither ? BMP_ENCODE_DITHER : 0, y );
+			memcpy( dst, enc, (size_t) row_size );
+		}
+	}
+	free( data );
+	free( rgbx );
+	free( enc );
+	return BMP_OK;
+}
+
+
+/* Writes bytes as rows of hexadecimal constants */
+static void bake_write_bytes( FILE* f, const u8* data, u64 size )
+{
+	u64 i;
+
+	for ( i = 0; i < size; i++ )
+		fprintf( f, ( i % 16 == 15 || i + 1 == size ) ? "0x%02x,\n" : ( i % 16 ) ? " 0x%02x," : "\t0x%02x,", data[ i ] );
+}
+
+/* Writes an identifier in uppercase */
+static void bake_write_upper( FILE* f, const char* s )
+{
+	for ( ; *s; s++ )
+		fputc( toupper( (unsigned char) *s ), f );
+}
+
+/* Writes a string as a C literal */
+static void bake_write_string( FILE* f, const char* s )
+{
+	fputc( '"', f );
+	for ( ; *s; s++ )
+	{
+		if ( *s == '"' || *s == '\\' ) fprintf( f, "\\%c", *s );
+		else if ( (unsigned char) *s < 0x20 ) fprintf( f, "\\%03o", (unsigned char) *s );
+		else fputc( *s, f );
+	}
+	fputc( '"', f );
+}
+
+
+/**************************************************************
+	Writes the header declaring the assets, their index and an
+	enum of their positions in the index.
+	Returns non-zero on success.
+**************************************************************/
+static int bake_write_header( BakeCtx* ctx, FILE* f )
+{
+	u32 i;
+
+	fprintf( f, "/* Generated by qdbmp-bake, do not edit */\n\n#ifndef _" );
+	bake_write_upper( f, ctx->prefix );
+	fprintf( f, "_ASSETS_H_\n#define _" );
+	bake_write_upper( f, ctx->prefix );
+	fprintf( f, "_ASSETS_H_\n\n#include <stdint.h>\n\n" );
+	fprintf( f,
+		"#ifndef QDBMP_BAKED_ASSET\n"
+		"#define QDBMP_BAKED_ASSET\n"
+		"\n"
+		"/* Pixel formats, the value is the pixel size in bytes; RGB565 pixels are little-endian words */\n"
+		"#define QDBMP_BAKED_GREY\t1\n"
+		"#define QDBMP_BAKED_RGB565\t2\n"
+		"#define QDBMP_BAKED_RGBX\t4\n"
+		"\n"
+		"/* Baked image, rows are packed and stored top row first */\n"
+		"typedef struct\n"
+		"{\n"
+		"\tconst char *name;\n"
+		"\tuint32_t width, height, stride, format;\n"
+		"\tconst uint8_t *pixels;\n"
+		"} QDBMPBakedAsset;\n"
+		"#endif\n\n" );
+
+	fprintf( f, "enum\n{\n" );
+	for ( i = 0; i < ctx->nb_assets; i++ )
+	{
+		fputc( '\t', f );
+		bake_write_upper( f, ctx->prefix );
+		fprintf( f, "_ASSET_" );
+		bake_write_upper( f, ctx->assets[ i ].name );
+		fprintf( f, " = %u,\n", i );
+	}
+	fputc( '\t', f );
+	bake_write_upper( f, ctx->prefix );
+	fprintf( f, "_NB_ASSETS = %u\n};\n\n", ctx->nb_assets );
+
+	fprintf( f, "extern const QDBMPBakedAsset %s_assets[ %u ];\n", ctx->prefix, MAX( ctx->nb_assets, 1 ) );
+	if ( ctx->blob )
+		fprintf( f, "extern const uint8_t %s_blob[];\n", ctx->prefix );
+	else for ( i = 0; i < ctx->nb_assets; i++ )
+		fprintf( f, "extern const uint8_t %s_%s[];\n", ctx->prefix, ctx->assets[ i ].name );
+	fprintf( f, "\n#endif\n" );
+	return !ferror( f );
+}
+
+
+/**************************************************************
+	Writes the pixels, as one array per asset or a single blob,
+	and the index. Arrays are aligned so that RGB565 and RGBX
+	pixels can be read as words. Returns non-zero on success.
+**************************************************************/
+static int bake_write_source( BakeCtx* ctx, FILE* f, const char* header )
+{
+	const char *base = strrchr( header, '/' );
+	static const u8 zeros[ BAKE_ALIGN ];
+	u64 offset = 0, size;
+	BakeAsset *a;
+	u32 i;
+
+	fprintf( f, "/* Generated by qdbmp-bake, do not edit */\n\n#include \"%s\"\n\n", base ? base + 1 : header );
+	fprintf( f,
+		"#if defined( __GNUC__ ) || defined( __clang__ )\n"
+		"#define QDBMP_BAKED_ALIGN __attribute__( ( aligned( %u ) ) )\n"
+		"#else\n"
+		"#define QDBMP_BAKED_ALIGN\n"
+		"#endif\n\n", BAKE_ALIGN );
+
+	if ( ctx->blob )
+		fprintf( f, "const uint8_t %s_blob[] QDBMP_BAKED_ALIGN =\n{\n", ctx->prefix );
+	for ( i = 0; i < ctx->nb_assets; i++ )
+	{
+		a = &ctx->assets[ i ];
+		size = (u64) a->stride * a->height;
+		if ( ctx->blob )
+		{
+			/* Assets start on aligned offsets */
+			if ( offset % BAKE_ALIGN )
+			{
+				bake_write_bytes( f, zeros, BAKE_ALIGN - offset % BAKE_ALIGN );
+				offset += BAKE_ALIGN - offset % BAKE_ALIGN;
+			}
+			fprintf( f, "\t/* %s */\n", a->name );
+			a->offset = offset;
+			offset += size;
+		}
+		else
+		{
+			fprintf( f, "const uint8_t %s_%s[] QDBMP_BAKED_ALIGN =\n{\n", ctx->prefix, a->name );
+		}
+		/* Empty arrays are not valid C */
+		bake_write_bytes( f, size ? a->pixels : zeros, size ? size : 1 );
+		offset += size ? 0 : 1;
+		if ( !ctx->blob )
+			fprintf( f, "};\n\n" );
+	}
+	if ( ctx->blob )
+	{
+		if ( !ctx->nb_assets ) bake_write_bytes( f, zeros, 1 );
+		fprintf( f, "};\n\n" );
+	}
+
+	fprintf( f, "const QDBMPBakedAsset %s_assets[ %u ] =\n{\n", ctx->prefix, MAX( ctx->nb_assets, 1 ) );
+	for ( i = 0; i < ctx->nb_assets; i++ )
+	{
+		a = &ctx->assets[ i ];
+		fprintf( f, "\t{ " );
+		bake_write_string( f, a->name );
+		fprintf( f, ", %u, %u, %u, %u, ", a->width, a->height, a->stride, ctx->format );
+		if ( ctx->blob )
+			fprintf( f, "%s_blob + %llu },\n", ctx->prefix, (unsigned long long) a->offset );
+		else
+			fprintf( f, "%s_%s },\n", ctx->prefix, a->name );
+	}
+	if ( !ctx->nb_assets )
+		fprintf( f, "\t{ 0 },\n" );
+	fprintf( f, "};\n" );
+	return !ferror( f );
+}
+
+
+/**************************************************************
+	Writes a generated file through a temporary file renamed
+	into place, so that an interrupted build does not leave a
+	truncated file newer than its inputs.
+	Returns non-zero on success.
+**************************************************************/
+static int bake_write_file( BakeCtx* ctx, const char* path, Bool header )
+{
+	char *tmp;
+	FILE *f;
+	int ok;
+
+	if ( asprintf( &tmp, "%s.tmp", path ) < 0 )
+		return 0;
+	f = fopen( tmp, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "%s: %s\n", tmp, strerror( errno ) );
+		free( tmp );
+		return 0;
+	}
+	ok = header ? bake_write_header( ctx, f ) : bake_write_source( ctx, f, ctx->out_h );
+	if ( fclose( f ) ) ok = 0;
+	if ( ok && rename( tmp, path ) ) ok = 0;
+	if ( !ok )
+	{
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		unlink( tmp );
+	}
+	free( tmp );
+	return ok;
+}
+
+static void bake_usage( const char* name )
+{
+	fprintf( stderr,
+		"Usage: %s [options] -o assets.c -H assets.h <file.bmp>...\n"
+		"Decodes BMP files and writes their pixels as C arrays, with an index of the assets.\n"
+		"\n"
+		"  -o file   C source file to write\n"
+		"  -H file   header file to write\n"
+		"  -n name   prefix of the generated identifiers, default is assets\n"
+		"  -f fmt    pixel format: rgbx (default), grey (BT.601 luma) or rgb565\n"
+		"  -D        ordered dithering of rgb565 pixels\n"
+		"  -b        write the pixels of all assets as a single blob instead of one array each\n", name );
+}
+
+int main( int argc, char** argv )
+{
+	BakeCtx ctx;
+	BMP_STATUS status;
+	u32 i;
+	int opt, ok = 1;
+	const char *p;
+
+	memset( &ctx, 0, sizeof( ctx ) );
+	ctx.prefix = "assets";
+	ctx.format = BAKE_RGBX;
+	while ( ( opt = getopt( argc, argv, "o:H:n:f:Db" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'o': ctx.out_c = optarg; break;
+		case 'H': ctx.out_h = optarg; break;
+		case 'n': ctx.prefix = optarg; break;
+		case 'f':
+			if ( !strcmp( optarg, "rgbx" ) ) ctx.format = BAKE_RGBX;
+			else if ( !strcmp( optarg, "grey" ) ) ctx.format = BAKE_GREY;
+			else if ( !strcmp( optarg, "rgb565" ) ) ctx.format = BAKE_RGB565;
+			else ok = 0;
+			break;
+		case 'D': ctx.dither = GF_TRUE; break;
+		case 'b': ctx.blob = GF_TRUE; break;
+		default: ok = 0; break;
+		}
+	}
+	/* The prefix is used as is in identifiers */
+	for ( p = ctx.prefix; ok && *p; p++ )
+		if ( !isalnum( (unsigned char) *p ) && *p != '_' ) ok = 0;
+	if ( !ok || !ctx.out_c || !ctx.out_h || !ctx.prefix[ 0 ] || isdigit( (unsigned char) ctx.prefix[ 0 ] ) )
+	{
+		bake_usage( argv[ 0 ] );
+		return 1;
+	}
+
+	ctx.nb_assets = argc - optind;
+	ctx.assets = calloc( MAX( ctx.nb_assets, 1 ), sizeof( BakeAsset ) );
+	if ( !ctx.assets )
+	{
+		fprintf( stderr, "Out of memory\n" );
+		return 1;
+	}
+	for ( i = 0; i < ctx.nb_assets; i++ )
+	{
+		BakeAsset *a = &ctx.assets[ i ];
+
+		a->path = argv[ optind + i ];
+		a->name = bake_name( a->path );
+		status = a->name ? bake_decode( &ctx, a ) : BMP_OUT_OF_MEMORY;
+		if ( status != BMP_OK )
+		{
+			fprintf( stderr, "%s: %s\n", a->path, StatusDescription( status ) );
+			ok = 0;
+		}
+	}
+	if ( ok )
+		ok = bake_check_symbols( &ctx );
+
+	/* Any failure fails the build, without touching the previous outputs */
+	if ( ok )
+		ok = bake_write_file( &ctx, ctx.out_h, GF_TRUE ) && bake_write_file( &ctx, ctx.out_c, GF_FALSE );
+
+	for ( i = 0; i < ctx.nb_assets; i++ )
+	{
+		free( ctx.assets[ i ].name );
+		free( ctx.assets[ i ].pixels );
+	}
+	free( ctx.assets );
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,949 @@
+/*
+**
+** qdbmp-batch: native command-line batch converter built on the QDBMP decode kernels.
+**
+** Decodes lists or directory trees of BMP files as tasks of the process-wide thread pool, optionally converting
+** them to raw RGBX, greyscale or QOI files, scaling them or hashing the decoded pixels, and reports
+** the aggregate throughput. Inputs are memory-mapped and outputs are written by a separate thread.
+** With -P, the parse and row decode stages of each file are measured with per-thread performance
+** counters, reported per file and aggregated per bit depth in the summary. With -T, the file, band
+** and wait spans of all threads are written as a Chrome trace-event file.
+**
+**
+** This file is part of Bevara Access Filters.
+**
+** This file is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation.
+**
+** This file is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along with this file. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "qdbmp_perf.h"
+#include "qdbmp_trace.h"
+#include "qdbmp_writer.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Output queue size above which workers wait for the writer, in bytes */
+#define BATCH_WRITE_BUDGET	( 256u << 20 )
+
+/* Output formats */
+enum
+{
+	BATCH_OUT_RGBX = 0,
+	BATCH_OUT_GREY,
+	BATCH_OUT_QOI,
+	BATCH_OUT_BMP,
+};
+
+/* Decode stages measured with -P */
+enum
+{
+	BATCH_STAGE_PARSE = 0,
+	BATCH_STAGE_ROWS,
+	BATCH_NB_STAGES,
+};
+
+static const char *BatchStageNames[ BATCH_NB_STAGES ] = { "parse", "rows" };
+
+/* Counters of the files of a bit depth */
+typedef struct
+{
+	u32 nb_files;
+	u64 nb_pixels;
+	PerfSample stages[ BATCH_NB_STAGES ];
+} BatchPerfStats;
+
+/* Input file, or member of a mapped tar archive */
+typedef struct
+{
+	char *path;
+	/* Output file, mirroring the input path under the output directory */
+	char *output;
+	u64 size;
+	/* Member data in the archive mapping, NULL for files */
+	const u8 *data;
+	/* Modification time given to the output, UTIME_OMIT to leave it */
+	struct timespec mtime;
+} BatchJob;
+
+/* Mapped tar archive, shared by the jobs of its members */
+typedef struct
+{
+	void *map;
+	u64 size;
+} BatchArchive;
+
+/* Decoded output waiting to be written */
+typedef struct _BatchWrite
+{
+	struct _BatchWrite *next;
+	char *path;
+	u8 *data;
+	u64 size;
+	/* Frame geometry, for BMP outputs */
+	u32 width, height;
+	const BatchJob *job;
+} BatchWrite;
+
+typedef struct
+{
+	//options
+	const char *outdir, *trace;
+	u32 format, scale_w, scale_h, nb_threads;
+	Bool hash, quiet, perf;
+	/* Depth and BMP_ENCODE_* flags of BMP outputs */
+	USHORT bmp_bpp;
+	u32 bmp_flags;
+
+	BatchJob *jobs;
+	u32 nb_jobs, alloc_jobs;
+	/* Pool groups of the file tasks and of the band tasks of the writer */
+	PoolGroup *pool, *write_pool;
+	/* Per thread state, indexed by the pool thread running the task */
+	struct _BatchWorker *workers;
+
+	BatchArchive *archives;
+	u32 nb_archives;
+
+	/* Asynchronous writer queue */
+	pthread_mutex_t write_lock;
+	pthread_cond_t write_ready, write_done;
+	BatchWrite *write_first, *write_last;
+	u64 write_pending;
+	Bool write_stop;
+	/* Bytes actually written, BMP outputs only rewrite their changed rows */
+	u64 nb_bytes_written;
+
+	/* Counters per bit depth, software counters being used when hardware ones are not permitted */
+	BatchPerfStats perf_stats[ 33 ];
+	Bool perf_software;
+
+	pthread_mutex_t log_lock;
+} BatchCtx;
+
+/* Per thread state and counters */
+typedef struct _BatchWorker
+{
+	BatchCtx *ctx;
+	u8 *row;
+	u32 row_size;
+	u64 nb_pixels, nb_bytes_in;
+	u32 nb_ok, nb_failed;
+	/* Counters of the thread, opened by its first task */
+	PerfCounters perf;
+	Bool perf_open;
+} BatchWorker;
+
+
+/**************************************************************
+	Returns the current time in seconds.
+**************************************************************/
+static double batch_now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**************************************************************
+	Adds a file to the job list. Returns non-zero on success.
+**************************************************************/
+static int batch_add_file( BatchCtx* ctx, const char* path, u64 size )
+{
+	if ( ctx->nb_jobs == ctx->alloc_jobs )
+	{
+		u32 alloc = ctx->alloc_jobs ? 2 * ctx->alloc_jobs : 256;
+		BatchJob *jobs = realloc( ctx->jobs, alloc * sizeof( BatchJob ) );
+		if ( !jobs ) return 0;
+		ctx->jobs = jobs;
+		ctx->alloc_jobs = alloc;
+	}
+	ctx->jobs[ ctx->nb_jobs ].path = strdup( path );
+	if ( !ctx->jobs[ ctx->nb_jobs ].path ) return 0;
+	ctx->jobs[ ctx->nb_jobs ].output = NULL;
+	ctx->jobs[ ctx->nb_jobs ].size = size;
+	ctx->jobs[ ctx->nb_jobs ].data = NULL;
+	ctx->jobs[ ctx->nb_jobs ].mtime.tv_sec = 0;
+	ctx->jobs[ ctx->nb_jobs ].mtime.tv_nsec = UTIME_OMIT;
+	ctx->nb_jobs++;
+	return 1;
+}
+
+
+/**************************************************************
+	Maps a tar archive and adds its BMP members to the job list,
+	indexing the member offsets in one pass over the headers.
+	Members are decoded from the mapping without extraction, and
+	their outputs get the member modification times.
+	Returns non-zero on success.
+**************************************************************/
+static int batch_add_archive( BatchCtx* ctx, const char* path, u64 size )
+{
+	BatchArchive *archives;
+	TarMember m;
+	char name[ 1024 ], *member_path;
+	const u8 *data;
+	u64 pos = 0;
+	void *map;
+	int fd, res, ok = 1;
+
+	archives = realloc( ctx->archives, ( ctx->nb_archives + 1 ) * sizeof( BatchArchive ) );
+	if ( !archives ) return 0;
+	ctx->archives = archives;
+
+	fd = open( path, O_RDONLY );
+	if ( fd < 0 || !size )
+	{
+		fprintf( stderr, "%s: %s\n", path, fd < 0 ? strerror( errno ) : "empty archive" );
+		if ( fd >= 0 ) close( fd );
+		return 0;
+	}
+	map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED )
+	{
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 0;
+	}
+	ctx->archives[ ctx->nb_archives ].map = map;
+	ctx->archives[ ctx->nb_archives ].size = size;
+	ctx->nb_archives++;
+
+	data = map;
+	if ( !IsTarArchive( data, size ) )
+	{
+		fprintf( stderr, "%s: not a tar archive\n", path );
+		return 0;
+	}
+	while ( ok && ( res = TarNextMember( data, size, &pos, &m ) ) == 1 )
+	{
+		/* Other files, such as capture logs, are skipped */
+		if ( m.size < 2 || data[ m.offset ] != 'B' || data[ m.offset + 1 ] != 'M' )
+			continue;
+
+		TarMemberName( data, size, &m, name, sizeof( name ) );
+		if ( asprintf( &member_path, "%s/%s", path, name ) < 0 )
+			return 0;
+		ok = batch_add_file( ctx, member_path, m.size );
+		free( member_path );
+		if ( ok )
+		{
+			ctx->jobs[ ctx->nb_jobs - 1 ].data = data + m.offset;
+			ctx->jobs[ ctx->nb_jobs - 1 ].mtime.tv_sec = (time_t) m.mtime;
+			ctx->jobs[ ctx->nb_jobs - 1 ].mtime.tv_nsec = m.mtime_ns;
+		}
+	}
+	if ( ok && res < 0 )
+		fprintf( stderr, "%s: corrupted tar header at offset %llu, ignoring the rest of the archive\n", path, (unsigned long long) pos );
+	return ok;
+}
+
+
+/**************************************************************
+	Adds a file, or the .bmp files of a directory tree, to the
+	job list. Returns non-zero on success.
+**************************************************************/
+static int batch_add_path( BatchCtx* ctx, const char* path, Bool from_dir )
+{
+	struct stat st;
+	struct dirent *ent;
+	DIR *dir;
+	char *child;
+	size_t len;
+	int ok = 1;
+
+	if ( stat( path, &st ) )
+	{
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 0;
+	}
+
+	if ( !S_ISDIR( st.st_mode ) )
+	{
+		/* Explicit inputs are taken as is, directory entries are filtered on their extension */
+		len = strlen( path );
+		if ( len >= 4 && !strcasecmp( path + len - 4, ".tar" ) )
+			return batch_add_archive( ctx, path, st.st_size );
+		if ( from_dir && ( len < 4 || strcasecmp( path + len - 4, ".bmp" ) ) )
+			return 1;
+		return batch_add_file( ctx, path, st.st_size );
+	}
+
+	dir = opendir( path );
+	if ( !dir )
+	{
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 0;
+	}
+	while ( ok && ( ent = readdir( dir ) ) != NULL )
+	{
+		if ( ent->d_name[ 0 ] == '.' ) continue;
+		if ( asprintf( &child, "%s/%s", path, ent->d_name ) < 0 )
+		{
+			ok = 0;
+			break;
+		}
+		/* Unreadable entries are reported and skipped */
+		batch_add_path( ctx, child, GF_TRUE );
+		free( child );
+	}
+	closedir( dir );
+	return ok;
+}
+
+
+/**************************************************************
+	Adds the paths listed in a file, one per line.
+	Returns non-zero on success.
+**************************************************************/
+static int batch_add_list( BatchCtx* ctx, const char* list )
+{
+	char *line = NULL;
+	size_t alloc = 0;
+	ssize_t len;
+	int ok = 1;
+	FILE *f = strcmp( list, "-" ) ? fopen( list, "r" ) : stdin;
+
+	if ( !f )
+	{
+		fprintf( stderr, "%s: %s\n", list, strerror( errno ) );
+		return 0;
+	}
+	while ( ok && ( len = getline( &line, &alloc, f ) ) >= 0 )
+	{
+		while ( len && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' ) )
+			line[ --len ] = 0;
+		if ( len )
+			ok = batch_add_path( ctx, line, GF_FALSE );
+	}
+	free( line );
+	if ( f != stdin ) fclose( f );
+	return ok;
+}
+
+/* Largest files first */
+static int batch_cmp_size( const void* a, const void* b )
+{
+	const BatchJob *ja = a, *jb = b;
+	return ( ja->size < jb->size ) - ( ja->size > jb->size );
+}
+
+
+/**************************************************************
+	Hands a decoded output to the writer thread, waiting while
+	the write queue is over budget. The writer frees the data.
+**************************************************************/
+static void batch_queue_write( BatchCtx* ctx, const BatchJob* job, char* path, u8* data, u64 size, u32 width, u32 height )
+{
+	BatchWrite *w = malloc( sizeof( BatchWrite ) );
+	u64 start = 0;
+
+	pthread_mutex_lock( &ctx->write_lock );
+	/* An empty queue always takes the output, so that frames over budget still go through */
+	if ( TraceEnabled && ctx->write_first && ctx->write_pending + size > BATCH_WRITE_BUDGET )
+		start = TraceNow();
+	while ( ctx->write_first && ctx->write_pending + size > BATCH_WRITE_BUDGET )
+		pthread_cond_wait( &ctx->write_done, &ctx->write_lock );
+	if ( start ) TraceSpan( "write queue wait", job->path, start, TraceNow() );
+
+	if ( !w )
+	{
+		pthread_mutex_unlock( &ctx->write_lock );
+		fprintf( stderr, "%s: out of memory\n", path );
+		free( path );
+		free( data );
+		return;
+	}
+	w->next = NULL;
+	w->path = path;
+	w->data = data;
+	w->size = size;
+	w->width = width;
+	w->height = height;
+	w->job = job;
+	if ( ctx->write_last ) ctx->write_last->next = w;
+	else ctx->write_first = w;
+	ctx->write_last = w;
+	ctx->write_pending += size;
+	pthread_cond_signal( &ctx->write_ready );
+	pthread_mutex_unlock( &ctx->write_lock );
+}
+
+
+/**************************************************************
+	Writer thread: writes the queued outputs in order until the
+	queue is drained and stopped.
+**************************************************************/
+static void* batch_writer( void* arg )
+{
+	BatchCtx *ctx = arg;
+	BatchWrite *w;
+	QDBMPWriter *bmp;
+	BMP_STATUS status;
+	u64 done, start;
+	ssize_t res;
+	int fd;
+
+	TraceThreadName( "writer", -1 );
+	pthread_mutex_lock( &ctx->write_lock );
+	while ( 1 )
+	{
+		while ( !ctx->write_first && !ctx->write_stop )
+			pthread_cond_wait( &ctx->write_ready, &ctx->write_lock );
+		w = ctx->write_first;
+		if ( !w ) break;
+		pthread_mutex_unlock( &ctx->write_lock );
+		start = TraceEnabled ? TraceNow() : 0;
+
+		if ( ctx->format == BATCH_OUT_BMP )
+		{
+			/* Existing outputs with the same geometry only get their changed rows rewritten */
+			bmp = WriterOpen( w->path );
+			if ( bmp ) bmp->pool = ctx->write_pool;
+			status = bmp ? WriterUpdate( bmp, w->data, w->width, w->height, 4 * w->width, 4, ctx->bmp_bpp, ctx->bmp_flags ) : BMP_IO_ERROR;
+			if ( status != BMP_OK )
+				fprintf( stderr, "%s: %s\n", w->path, StatusDescription( status ) );
+			fd = bmp ? bmp->fd : -1;
+			done = bmp ? bmp->nb_bytes : 0;
+		}
+		else
+		{
+			bmp = NULL;
+			fd = open( w->path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+			for ( done = 0; fd >= 0 && done < w->size; done += res )
+			{
+				res = write( fd, w->data + done, w->size - done );
+				if ( res <= 0 ) break;
+			}
+			if ( fd < 0 || done < w->size )
+				fprintf( stderr, "%s: %s\n", w->path, strerror( errno ) );
+		}
+		if ( fd >= 0 )
+		{
+			if ( w->job->mtime.tv_nsec != UTIME_OMIT )
+			{
+				struct timespec times[ 2 ] = { { 0, UTIME_OMIT }, w->job->mtime };
+				futimens( fd, times );
+			}
+			if ( bmp ) WriterClose( bmp );
+			else close( fd );
+		}
+		if ( TraceEnabled ) TraceSpan( "write", w->job->path, start, TraceNow() );
+
+		pthread_mutex_lock( &ctx->write_lock );
+		ctx->nb_bytes_written += done;
+		ctx->write_first = w->next;
+		if ( !ctx->write_first ) ctx->write_last = NULL;
+		ctx->write_pending -= w->size;
+		pthread_cond_broadcast( &ctx->write_done );
+		free( w->path );
+		free( w->data );
+		free( w );
+	}
+	pthread_mutex_unlock( &ctx->write_lock );
+	return NULL;
+}
+
+
+/**************************************************************
+	Returns the output file of an input: its path, archive
+	members included, mirrored under the output directory with
+	the extension of the output format. Root, "." and ".."
+	components are dropped so that outputs stay in the directory.
+**************************************************************/
+static char* batch_output_path( BatchCtx* ctx, const char* path )
+{
+	const char *ext = ( ctx->format == BATCH_OUT_QOI ) ? "qoi" : ( ctx->format == BATCH_OUT_GREY ) ? "grey" : ( ctx->format == BATCH_OUT_BMP ) ? "bmp" : "rgbx";
+	const char *name, *end, *dot;
+	size_t len = strlen( ctx->outdir );
+	char *out, *pos;
+
+	out = malloc( len + strlen( path ) + strlen( ext ) + 3 );
+	if ( !out ) return NULL;
+	memcpy( out, ctx->outdir, len );
+	pos = out + len;
+
+	for ( name = path; *name; name = *end ? end + 1 : end )
+	{
+		end = strchr( name, '/' );
+		if ( !end ) end = name + strlen( name );
+		if ( end == name || ( end - name == 1 && name[ 0 ] == '.' ) || ( end - name == 2 && name[ 0 ] == '.' && name[ 1 ] == '.' ) )
+			continue;
+		*pos++ = '/';
+		/* The extension of the file name is replaced */
+		dot = *end ? NULL : strrchr( name, '.' );
+		if ( dot == name ) dot = NULL;
+		memcpy( pos, name, ( dot ? dot : end ) - name );
+		pos += ( dot ? dot : end ) - name;
+	}
+	sprintf( pos, ".%s", ext );
+	return out;
+}
+
+
+/**************************************************************
+	Creates the missing parent directories of an output file.
+	Returns non-zero on success.
+**************************************************************/
+static int batch_make_parents( char* path )
+{
+	char *sep;
+
+	for ( sep = strchr( path + 1, '/' ); sep; sep = strchr( sep + 1, '/' ) )
+	{
+		*sep = 0;
+		if ( mkdir( path, 0755 ) && errno != EEXIST )
+		{
+			fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+			*sep = '/';
+			return 0;
+		}
+		*sep = '/';
+	}
+	return 1;
+}
+
+/* Orders jobs on their output file */
+static int batch_cmp_output( const void* a, const void* b )
+{
+	return strcmp( ( *(const BatchJob* const*) a )->output, ( *(const BatchJob* const*) b )->output );
+}
+
+
+/**************************************************************
+	Names the output of every job and creates their directories.
+	Inputs that would be written to the same file, such as files
+	of the same path in different archives, are reported and
+	fail the batch before anything is decoded.
+	Returns non-zero on success.
+**************************************************************/
+static int batch_prepare_outputs( BatchCtx* ctx )
+{
+	BatchJob **sorted;
+	u32 i;
+	int ok = 1;
+
+	sorted = malloc( ctx->nb_jobs * sizeof( BatchJob* ) );
+	if ( !sorted ) return 0;
+	for ( i = 0; i < ctx->nb_jobs; i++ )
+	{
+		ctx->jobs[ i ].output = batch_output_path( ctx, ctx->jobs[ i ].path );
+		if ( !ctx->jobs[ i ].output )
+		{
+			free( sorted );
+			return 0;
+		}
+		sorted[ i ] = &ctx->jobs[ i ];
+	}
+
+	qsort( sorted, ctx->nb_jobs, sizeof( BatchJob* ), batch_cmp_output );
+	for ( i = 1; i < ctx->nb_jobs; i++ )
+	{
+		if ( strcmp( sorted[ i - 1 ]->output, sorted[ i ]->output ) ) continue;
+		fprintf( stderr, "%s and %s would both be written to %s\n", sorted[ i - 1 ]->path, sorted[ i ]->path, sorted[ i ]->output );
+		ok = 0;
+	}
+	for ( i = 0; ok && i < ctx->nb_jobs; i++ )
+		ok = batch_make_parents( ctx->jobs[ i ].output );
+	free( sorted );
+	return ok;
+}
+
+/* 64-bit FNV-1a over a block of bytes */
+static u64 batch_hash( u64 h, const u8* data, u32 size )
+{
+	u32 i;
+	for ( i = 0; i < size; i++ )
+		h = ( h ^ data[ i ] ) * 0x100000001b3ULL;
+	return h;
+}
+
+
+/* Prints the counters of the stages, divided by nb_pixels if not 0 */
+static void batch_print_perf( BatchCtx* ctx, const PerfSample* stages, u64 nb_pixels )
+{
+	u32 i, j;
+
+	for ( i = 0; i < BATCH_NB_STAGES; i++ )
+	{
+		printf( "  %s:", BatchStageNames[ i ] );
+		for ( j = 0; j < PERF_NB_COUNTERS; j++ )
+		{
+			if ( nb_pixels )
+				printf( " %s %.3f/px", PerfCounterName( ctx->perf_software, j ), (double) stages[ i ].values[ j ] / nb_pixels );
+			else
+				printf( " %s %llu", PerfCounterName( ctx->perf_software, j ), (unsigned long long) stages[ i ].values[ j ] );
+		}
+		/* Instructions per cycle tell compute-bound stages from memory-bound ones */
+		if ( !ctx->perf_software && stages[ i ].values[ 0 ] )
+			printf( " IPC %.2f", (double) stages[ i ].values[ 1 ] / stages[ i ].values[ 0 ] );
+		printf( "\n" );
+	}
+}
+
+
+/**************************************************************
+	Decodes one file from its mapping, row by row. Outputs are
+	converted in a frame buffer handed to the writer; without an
+	output the rows only go through the worker's row buffer.
+	Returns BMP_OK on success.
+**************************************************************/
+static BMP_STATUS batch_decode( BatchWorker* wk, const BatchJob* job, const u8* data )
+{
+	BatchCtx *ctx = wk->ctx;
+	QDBMPSource src;
+	QOIState qoi;
+	u8 *frame = NULL, *out = NULL, *row;
+	u32 y, w, h, pixel_size, row_size;
+	u64 frame_size = 0, hash = 0xcbf29ce484222325ULL;
+	PerfSample p0, p1, p2, stages[ BATCH_NB_STAGES ];
+	BMP_STATUS status;
+
+	if ( ctx->perf ) PerfRead( &wk->perf, &p0 );
+	status = ReadSource( data, job->size, 0, ( ctx->format == BATCH_OUT_GREY ) ? 1 : 0, &src );
+	if ( status == BMP_OK )
+		status = LocateRows( &src, data, job->size );
+	if ( status != BMP_OK )
+		return status;
+	if ( ctx->perf ) PerfRead( &wk->perf, &p1 );
+
+	w = ctx->scale_w ? ctx->scale_w : src.width;
+	h = ctx->scale_h ? ctx->scale_h : src.height;
+	pixel_size = ( ctx->format == BATCH_OUT_GREY ) ? 1 : 4;
+
+	/* Rows of very wide images, or scaled to a very large width, do not fit in the buffers */
+	if ( (u64) w * pixel_size > 0xFFFFFFFF )
+		return BMP_OUT_OF_MEMORY;
+	row_size = w * pixel_size;
+
+	if ( wk->row_size < row_size )
+	{
+		u8 *buf = realloc( wk->row, row_size );
+		if ( !buf ) return BMP_OUT_OF_MEMORY;
+		wk->row = buf;
+		wk->row_size = row_size;
+	}
+
+	if ( ctx->outdir )
+	{
+		/* QOI needs at most 4 bytes per opaque pixel */
+		frame_size = (u64) w * h * pixel_size;
+		if ( ctx->format == BATCH_OUT_QOI ) frame_size += QOI_HEADER_SIZE + QOI_END_SIZE;
+		if ( frame_size != (size_t) frame_size ) return BMP_OUT_OF_MEMORY;
+		frame = malloc( (size_t) frame_size );
+		if ( !frame ) return BMP_OUT_OF_MEMORY;
+		out = ( ctx->format == BATCH_OUT_QOI ) ? QOIStart( &qoi, frame, w, h, 3 ) : frame;
+	}
+
+	for ( y = 0; y < h; y++ )
+	{
+		/* Raw outputs are converted in place, QOI goes through the row buffer */
+		row = ( out && ctx->format != BATCH_OUT_QOI ) ? out + (u64) y * row_size : wk->row;
+
+		if ( ctx->format == BATCH_OUT_GREY )
+			GreyRow( row, BMP_SOURCE_ROW( &src, y ), w, src.bpp, src.grey_lut, 0, 1 );
+		else
+			ScaleColorRow( row, BMP_SOURCE_ROW( &src, (u64) y * src.height / h ), w, src.width, src.bpp, src.color_lut );
+
+		if ( ctx->hash )
+			hash = batch_hash( hash, row, row_size );
+		if ( out && ctx->format == BATCH_OUT_QOI )
+			out = QOIEncodeRow( &qoi, out, row, w );
+	}
+
+	if ( out && ctx->format == BATCH_OUT_QOI )
+		frame_size = QOIFinish( &qoi, out ) - frame;
+
+	wk->nb_pixels += (u64) src.width * src.height;
+	wk->nb_bytes_in += job->size;
+
+	if ( ctx->perf )
+	{
+		PerfRead( &wk->perf, &p2 );
+		memset( stages, 0, sizeof( stages ) );
+		PerfAdd( &stages[ BATCH_STAGE_PARSE ], &p0, &p1 );
+		PerfAdd( &stages[ BATCH_STAGE_ROWS ], &p1, &p2 );
+	}
+
+	if ( !ctx->quiet || ctx->perf )
+	{
+		pthread_mutex_lock( &ctx->log_lock );
+		if ( !ctx->quiet )
+		{
+			if ( ctx->hash )
+				printf( "%s: %ux%u %ubpp -> %ux%u %016llx\n", job->path, src.width, src.height, src.bpp, w, h, (unsigned long long) hash );
+			else
+				printf( "%s: %ux%u %ubpp -> %ux%u\n", job->path, src.width, src.height, src.bpp, w, h );
+		}
+		if ( ctx->perf )
+		{
+			BatchPerfStats *stats = &ctx->perf_stats[ src.bpp ];
+			if ( !ctx->quiet )
+				batch_print_perf( ctx, stages, 0 );
+			stats->nb_files++;
+			stats->nb_pixels += (u64) src.width * src.height;
+			for ( y = 0; y < BATCH_NB_STAGES; y++ )
+				PerfAdd( &stats->stages[ y ], NULL, &stages[ y ] );
+		}
+		pthread_mutex_unlock( &ctx->log_lock );
+	}
+
+	if ( frame )
+	{
+		char *path = strdup( job->output );
+		if ( !path )
+		{
+			free( frame );
+			return BMP_OUT_OF_MEMORY;
+		}
+		batch_queue_write( ctx, job, path, frame, frame_size, w, h );
+	}
+	return BMP_OK;
+}
+
+
+/**************************************************************
+	Maps a file and decodes it, archive members are decoded from
+	the archive mapping. Returns BMP_OK on success.
+**************************************************************/
+static BMP_STATUS batch_process( BatchWorker* wk, const BatchJob* job )
+{
+	BMP_STATUS status;
+	void *data;
+	int fd;
+
+	if ( job->data )
+		return batch_decode( wk, job, job->data );
+
+	fd = open( job->path, O_RDONLY );
+	if ( fd < 0 )
+		return BMP_FILE_NOT_FOUND;
+	if ( !job->size )
+	{
+		close( fd );
+		return BMP_FILE_INVALID;
+	}
+
+	data = mmap( NULL, job->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( data == MAP_FAILED )
+		return BMP_IO_ERROR;
+	madvise( data, job->size, MADV_SEQUENTIAL );
+
+	status = batch_decode( wk, job, data );
+	munmap( data, job->size );
+	return status;
+}
+
+
+/* File task: decodes one file with the state of the thread running it */
+static void batch_task( void* arg, u32 index, u32 thread )
+{
+	BatchCtx *ctx = arg;
+	BatchWorker *wk = &ctx->workers[ thread ];
+	BMP_STATUS status;
+	u64 start = TraceEnabled ? TraceNow() : 0;
+
+	if ( ctx->perf && !wk->perf_open )
+	{
+		PerfOpen( &wk->perf );
+		wk->perf_open = GF_TRUE;
+		if ( wk->perf.software ) ctx->perf_software = GF_TRUE;
+	}
+	status = batch_process( wk, &ctx->jobs[ index ] );
+	if ( TraceEnabled ) TraceSpan( "decode", ctx->jobs[ index ].path, start, TraceNow() );
+	if ( status == BMP_OK )
+	{
+		wk->nb_ok++;
+		return;
+	}
+	wk->nb_failed++;
+	pthread_mutex_lock( &ctx->log_lock );
+	fprintf( stderr, "%s: %s\n", ctx->jobs[ index ].path, StatusDescription( status ) );
+	pthread_mutex_unlock( &ctx->log_lock );
+}
+
+static void batch_usage( const char* name )
+{
+	fprintf( stderr,
+		"Usage: %s [options] <file.bmp | archive.tar | dir | @list>...\n"
+		"Decodes BMP files in parallel; directories are searched recursively for .bmp files,\n"
+		"the BMP members of uncompressed .tar archives are decoded without extraction,\n"
+		"@list reads one path per line from a file (@- for stdin).\n"
+		"\n"
+		"  -o dir    write the decoded frames to dir, at the paths of the inputs (archive members\n"
+		"            under the archive path); inputs that map to the same file are rejected\n"
+		"  -f fmt    output format: rgbx (default), grey (BT.601 luma), qoi, bmp (24 BPP),\n"
+		"            bmp565 or bmp555 (16 BPP BI_BITFIELDS); existing BMP files of the same\n"
+		"            size only get their changed rows rewritten\n"
+		"  -D        ordered dithering of 16 BPP BMP outputs\n"
+		"  -s WxH    scale the frames to WxH with nearest neighbour sampling (rgbx and qoi)\n"
+		"  -H        print a 64-bit FNV-1a hash of the decoded pixels of each file\n"
+		"  -j n      number of threads of the pool, default is the number of cores\n"
+		"  -P        measure the parse and row decode stages with performance counters, per\n"
+		"            file and per bit depth (software counters if hardware ones are not permitted)\n"
+		"  -T file   write the decode, band encode and wait spans of all threads to file,\n"
+		"            in the Chrome trace-event format (chrome://tracing, Perfetto)\n"
+		"  -q        only print errors and the summary\n", name );
+}
+
+int main( int argc, char** argv )
+{
+	BatchCtx ctx;
+	pthread_t writer;
+	u32 i, nb_workers, nb_ok = 0, nb_failed = 0;
+	u64 nb_pixels = 0, nb_bytes_in = 0;
+	double start, elapsed;
+	int opt, ok = 1;
+
+	memset( &ctx, 0, sizeof( ctx ) );
+	while ( ( opt = getopt( argc, argv, "o:f:s:DHj:PT:q" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'o': ctx.outdir = optarg; break;
+		case 'f':
+			if ( !strcmp( optarg, "rgbx" ) ) ctx.format = BATCH_OUT_RGBX;
+			else if ( !strcmp( optarg, "grey" ) ) ctx.format = BATCH_OUT_GREY;
+			else if ( !strcmp( optarg, "qoi" ) ) ctx.format = BATCH_OUT_QOI;
+			else if ( !strcmp( optarg, "bmp" ) ) ctx.format = BATCH_OUT_BMP, ctx.bmp_bpp = 24;
+			else if ( !strcmp( optarg, "bmp565" ) ) ctx.format = BATCH_OUT_BMP, ctx.bmp_bpp = 16, ctx.bmp_flags &= ~BMP_ENCODE_555;
+			else if ( !strcmp( optarg, "bmp555" ) ) ctx.format = BATCH_OUT_BMP, ctx.bmp_bpp = 16, ctx.bmp_flags |= BMP_ENCODE_555;
+			else ok = 0;
+			break;
+		case 'D': ctx.bmp_flags |= BMP_ENCODE_DITHER; break;
+		case 's':
+			if ( sscanf( optarg, "%ux%u", &ctx.scale_w, &ctx.scale_h ) != 2 || !ctx.scale_w || !ctx.scale_h ) ok = 0;
+			break;
+		case 'H': ctx.hash = GF_TRUE; break;
+		case 'j': ctx.nb_threads = atoi( optarg ); break;
+		case 'P': ctx.perf = GF_TRUE; break;
+		case 'T': ctx.trace = optarg; break;
+		case 'q': ctx.quiet = GF_TRUE; break;
+		default: ok = 0; break;
+		}
+	}
+	if ( !ok || optind == argc || ( ctx.scale_w && ctx.format == BATCH_OUT_GREY ) )
+	{
+		batch_usage( argv[ 0 ] );
+		return 1;
+	}
+	for ( i = optind; i < (u32) argc; i++ )
+	{
+		if ( argv[ i ][ 0 ] == '@' ) batch_add_list( &ctx, argv[ i ] + 1 );
+		else batch_add_path( &ctx, argv[ i ], GF_FALSE );
+	}
+	if ( !ctx.nb_jobs )
+	{
+		fprintf( stderr, "No input files\n" );
+		return 1;
+	}
+
+	/* Files are taken largest first so that the last ones to complete are small */
+	qsort( ctx.jobs, ctx.nb_jobs, sizeof( BatchJob ), batch_cmp_size );
+
+	/* Pool threads are named in the trace when they start */
+	if ( ctx.trace )
+	{
+		TraceStart();
+		TraceThreadName( "main", -1 );
+	}
+
+	/* Tasks run on the pool threads and on this thread, which gets the last state */
+	nb_workers = PoolStart( ctx.nb_threads ) + 1;
+	ctx.workers = calloc( nb_workers, sizeof( BatchWorker ) );
+	ctx.pool = PoolGroupNew( GF_FALSE );
+	/* The writer thread unblocks the file tasks waiting on the write budget, its bands go first */
+	ctx.write_pool = PoolGroupNew( GF_TRUE );
+	if ( !ctx.workers || !ctx.pool || !ctx.write_pool )
+	{
+		fprintf( stderr, "Out of memory\n" );
+		return 1;
+	}
+	for ( i = 0; i < nb_workers; i++ )
+		ctx.workers[ i ].ctx = &ctx;
+
+	if ( ctx.outdir && mkdir( ctx.outdir, 0755 ) && errno != EEXIST )
+	{
+		fprintf( stderr, "%s: %s\n", ctx.outdir, strerror( errno ) );
+		return 1;
+	}
+	if ( ctx.outdir && !batch_prepare_outputs( &ctx ) )
+		return 1;
+
+	pthread_mutex_init( &ctx.log_lock, NULL );
+	pthread_mutex_init( &ctx.write_lock, NULL );
+	pthread_cond_init( &ctx.write_ready, NULL );
+	pthread_cond_init( &ctx.write_done, NULL );
+	if ( ctx.outdir && pthread_create( &writer, NULL, batch_writer, &ctx ) )
+	{
+		fprintf( stderr, "Cannot start the writer thread\n" );
+		return 1;
+	}
+
+	start = batch_now();
+	PoolRun( ctx.pool, batch_task, &ctx, ctx.nb_jobs );
+
+	if ( ctx.outdir )
+	{
+		pthread_mutex_lock( &ctx.write_lock );
+		ctx.write_stop = GF_TRUE;
+		pthread_cond_signal( &ctx.write_ready );
+		pthread_mutex_unlock( &ctx.write_lock );
+		pthread_join( writer, NULL );
+	}
+	elapsed = batch_now() - start;
+
+	for ( i = 0; i < nb_workers; i++ )
+	{
+		nb_ok += ctx.workers[ i ].nb_ok;
+		nb_failed += ctx.workers[ i ].nb_failed;
+		nb_pixels += ctx.workers[ i ].nb_pixels;
+		nb_bytes_in += ctx.workers[ i ].nb_bytes_in;
+		free( ctx.workers[ i ].row );
+		if ( ctx.workers[ i ].perf_open ) PerfClose( &ctx.workers[ i ].perf );
+	}
+	fprintf( stderr, "%u files decoded, %u failed, %.1f MP in %.3f s: %.1f MP/s, %.1f MB/s in, %.1f MB written\n",
+		nb_ok, nb_failed, nb_pixels / 1e6, elapsed, elapsed > 0 ? nb_pixels / 1e6 / elapsed : 0,
+		elapsed > 0 ? nb_bytes_in / 1e6 / elapsed : 0, ctx.nb_bytes_written / 1e6 );
+	for ( i = 0; ctx.perf && i <= 32; i++ )
+	{
+		if ( !ctx.perf_stats[ i ].nb_files ) continue;
+		printf( "%u bpp: %u files, %.1f MP\n", i, ctx.perf_stats[ i ].nb_files, ctx.perf_stats[ i ].nb_pixels / 1e6 );
+		batch_print_perf( &ctx, ctx.perf_stats[ i ].stages, MAX( 1, ctx.perf_stats[ i ].nb_pixels ) );
+	}
+
+	/* The pool threads must have exited before the trace is written, the spans refer to the job paths */
+	PoolGroupDel( ctx.pool );
+	PoolGroupDel( ctx.write_pool );
+	PoolStop();
+	if ( ctx.trace && !TraceWrite( ctx.trace ) )
+		fprintf( stderr, "%s: %s\n", ctx.trace, strerror( errno ) );
+
+	for ( i = 0; i < ctx.nb_jobs; i++ )
+	{
+		free( ctx.jobs[ i ].path );
+		free( ctx.jobs[ i ].output );
+	}
+	free( ctx.jobs );
+	for ( i = 0; i < ctx.nb_archives; i++ )
+		munmap( ctx.archives[ i ].map, ctx.archives[ i ].size );
+	free( ctx.archives );
+	free( ctx.workers );
+	return nb_failed ? 2 : 0;
+}